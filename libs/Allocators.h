@@ -1,6 +1,8 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <mutex>
 #include <vector>
 #include <memory>
 #include <cstdint>
@@ -127,6 +129,297 @@ struct retail_allocator {
     std::shared_ptr<PoolArray> pool;
 };
 
+/** Central free list of one size bank, shared by all threads. Objects move
+ * in and out in batches: linked lists of objects through their first word,
+ * chained to the next batch through their second. Batches sit on a
+ * lock-free stack whose head carries a 16-bit tag against ABA. Carving new
+ * objects from the block allocator is rare and done under the caller's lock.
+ */
+template <class BlockAlloc>
+struct central_pool {
+    void init(size_t bytes) {
+        size = std::max(2 * sizeof(void*), bytes);
+        batch = std::max<size_t>(1, std::min<size_t>(64, 65536 / size));
+        head.store(0, std::memory_order_relaxed);
+    }
+
+    //! Pushes a batch of objects linked through their first word
+    void push(void* first) {
+        uint64_t old = head.load(std::memory_order_relaxed);
+        uint64_t tagged;
+        do {
+            ((void**)first)[1] = untag(old);
+            tagged = (uintptr_t)first | ((old + TAGONE) & TAGMASK);
+        } while (!head.compare_exchange_weak(old, tagged, std::memory_order_release,
+                                             std::memory_order_relaxed));
+    }
+
+    //! Pops a batch or returns nullptr. Memory is only given back to the
+    //! system with the whole pool, so reading a stale next link is safe.
+    void* pop() {
+        uint64_t old = head.load(std::memory_order_acquire);
+        while (untag(old) != nullptr) {
+            void* next = ((void**)untag(old))[1];
+            uint64_t tagged = (uintptr_t)next | ((old + TAGONE) & TAGMASK);
+            if (head.compare_exchange_weak(old, tagged, std::memory_order_acquire,
+                                           std::memory_order_acquire)) {
+                return untag(old);
+            }
+        }
+        return nullptr;
+    }
+
+    //! Carves a new batch out of the block allocator
+    void* carve(BlockAlloc& balloc) {
+        void* first = nullptr;
+        for (size_t j = 0; j < batch; ++j) {
+            if (spaceleft < size) {
+                MemBlock block = balloc.allocate_block(size * batch);
+                spaceleft = block.size;
+                spaceptr = (uint8_t*)block.ptr;
+                if (spaceptr == nullptr) {
+                    fprintf(stderr, "Could not allocate memory \n");
+                    std::exit(1);
+                }
+                // Every object comes from a block, so checking blocks keeps
+                // the tag bits of all pushed pointers clear
+                if (((uintptr_t)spaceptr + block.size - 1) & TAGMASK) {
+                    fprintf(stderr, "Block at %p does not fit 48-bit tagged pointers\n",
+                            block.ptr);
+                    std::exit(1);
+                }
+            }
+            *((void**)spaceptr) = first;
+            first = spaceptr;
+            spaceptr += size;
+            spaceleft -= size;
+        }
+        return first;
+    }
+
+    static void* untag(uint64_t value) {
+        return (void*)(value & ~TAGMASK);
+    }
+    // User space pointers fit in the low 48 bits on x86-64 with 4-level
+    // paging and on most 64-bit targets; carve() checks every block
+    static constexpr uint64_t TAGONE = 1ULL << 48;
+    static constexpr uint64_t TAGMASK = ~((1ULL << 48) - 1);
+
+    std::atomic<uint64_t> head{0};
+    size_t size = 0;   //! Bytes per object
+    size_t batch = 0;  //! Objects moved to/from a thread cache at once
+    uint8_t* spaceptr = nullptr;
+    size_t spaceleft = 0;
+};
+
+/** State shared by all copies of a threaded_retail_allocator: the block
+ * allocator, one central pool per size bank, and the registry that lets
+ * exiting threads return their cached objects only to pools still alive.
+ * Ids index the per-thread cache tables and are reused once their pool is
+ * destroyed, so the tables are as large as the most pools alive at once.
+ * Entries also carry the never reused serial number of their pool, and a
+ * thread's entry left over from a destroyed pool is dropped, never drained.
+ */
+template <class BlockAlloc>
+struct threaded_pool {
+    using Central = central_pool<BlockAlloc>;
+
+    //! Objects of one bank cached by one thread
+    struct Cache {
+        void* head = nullptr;
+        size_t count = 0;
+    };
+    using CacheSet = std::array<Cache, 64>;
+
+    threaded_pool() : serial(next_serial().fetch_add(1)) {
+        for (size_t j = 0; j < banks.size(); ++j) {
+            auto range = irange2<1>(j);
+            banks[j].init(range.base + range.range);
+        }
+        std::lock_guard<std::mutex> guard(registry_lock());
+        Registry& reg(registry());
+        if (reg.free.empty()) {
+            id = reg.pools.size();
+            reg.pools.push_back(this);
+        } else {
+            id = reg.free.back();
+            reg.free.pop_back();
+            reg.pools[id] = this;
+        }
+    }
+    ~threaded_pool() {
+        std::lock_guard<std::mutex> guard(registry_lock());
+        Registry& reg(registry());
+        reg.pools[id] = nullptr;
+        reg.free.push_back(id);
+    }
+
+    void* alloc(int bank) {
+        Cache& cache(caches()[bank]);
+        if (cache.head == nullptr) refill(bank, cache);
+        void* res = cache.head;
+        cache.head = *((void**)res);
+        --cache.count;
+        return res;
+    }
+
+    //! Objects freed by a thread other than the allocating one simply join
+    //! this thread's cache; full batches flow back through the central pool
+    void free(int bank, void* ptr) {
+        Cache& cache(caches()[bank]);
+        *((void**)ptr) = cache.head;
+        cache.head = ptr;
+        if (++cache.count >= 2 * banks[bank].batch) release(bank, cache);
+    }
+
+private:
+    void refill(int bank, Cache& cache) {
+        Central& central(banks[bank]);
+        void* first = central.pop();
+        if (first == nullptr) {
+            std::lock_guard<std::mutex> guard(blocklock);
+            first = central.carve(balloc);
+        }
+        // Batches returned by exiting threads can be short, so count
+        size_t count = 0;
+        for (void* ptr = first; ptr != nullptr; ptr = *((void**)ptr)) ++count;
+        cache.head = first;
+        cache.count = count;
+    }
+
+    //! Moves one batch from the cache to the central pool
+    void release(int bank, Cache& cache) {
+        Central& central(banks[bank]);
+        void* first = cache.head;
+        void* last = first;
+        for (size_t j = 1; j < central.batch; ++j) last = *((void**)last);
+        cache.head = *((void**)last);
+        *((void**)last) = nullptr;
+        cache.count -= central.batch;
+        central.push(first);
+    }
+
+    //! Returns everything a thread cached to its pool, at thread exit
+    void drain(CacheSet& set) {
+        for (size_t bank = 0; bank < set.size(); ++bank) {
+            Cache& cache(set[bank]);
+            while (cache.count >= banks[bank].batch) release(bank, cache);
+            if (cache.head != nullptr) banks[bank].push(cache.head);
+            cache = Cache();
+        }
+    }
+
+    struct LocalSet {
+        size_t serial = 0;
+        std::unique_ptr<CacheSet> set;
+    };
+    struct ThreadCaches {
+        std::vector<LocalSet> sets;
+        //! Whether the set at id belongs to a pool still alive, with the
+        //! registry locked
+        bool live(size_t id) const {
+            const std::vector<threaded_pool*>& pools(registry().pools);
+            return sets[id].set && (id < pools.size()) && (pools[id] != nullptr) &&
+                   (pools[id]->serial == sets[id].serial);
+        }
+        ~ThreadCaches() {
+            std::lock_guard<std::mutex> guard(registry_lock());
+            for (size_t id = 0; id < sets.size(); ++id) {
+                if (live(id)) registry().pools[id]->drain(*sets[id].set);
+            }
+        }
+    };
+
+    //! This thread's caches for this pool, created on first use
+    CacheSet& caches() {
+        ThreadCaches& local(thread_caches());
+        if ((id < local.sets.size()) && (local.sets[id].serial == serial)) {
+            return *local.sets[id].set;
+        }
+        return create(local);
+    }
+
+    //! Slow path of caches(), which also drops the sets of dead pools
+    CacheSet& create(ThreadCaches& local) {
+        {
+            std::lock_guard<std::mutex> guard(registry_lock());
+            for (size_t j = 0; j < local.sets.size(); ++j) {
+                if (!local.live(j)) local.sets[j] = LocalSet();
+            }
+        }
+        if (id >= local.sets.size()) local.sets.resize(id + 1);
+        LocalSet& entry(local.sets[id]);
+        entry.serial = serial;
+        entry.set.reset(new CacheSet());
+        return *entry.set;
+    }
+
+    static ThreadCaches& thread_caches() {
+        thread_local ThreadCaches local;
+        return local;
+    }
+    static std::atomic<size_t>& next_serial() {
+        static std::atomic<size_t> counter{1};
+        return counter;
+    }
+    //! Live pools by id, nullptr where the id is free
+    struct Registry {
+        std::vector<threaded_pool*> pools;
+        std::vector<size_t> free;
+    };
+    static Registry& registry() {
+        static Registry reg;
+        return reg;
+    }
+    static std::mutex& registry_lock() {
+        static std::mutex lock;
+        return lock;
+    }
+
+    size_t id;            //! Index in the thread caches, reused
+    const size_t serial;  //! Unique to this pool
+    BlockAlloc balloc;
+    std::mutex blocklock;  //! Guards balloc and carving
+    std::array<Central, 64> banks;
+};
+
+/** Same as retail_allocator but safe to share between threads. Each thread
+ * allocates from and frees to its own per-bank cache with no atomics, and
+ * exchanges whole batches with the lock-free central pools when a cache
+ * runs empty or grows past two batches.
+ */
+template <typename T, typename BlockAllocator>
+struct threaded_retail_allocator {
+    using value_type = T;
+    using Pool = threaded_pool<BlockAllocator>;
+    threaded_retail_allocator() : pool(std::make_shared<Pool>()) {
+    }
+    threaded_retail_allocator(const threaded_retail_allocator&) = default;
+    template <typename U, typename B>
+    constexpr threaded_retail_allocator(
+        const threaded_retail_allocator<U, B>& rhs) noexcept
+        : pool(rhs.pool) {
+    }
+
+    T* allocate(std::size_t n) {
+        size_t bytes = std::max(2 * sizeof(void*), n * sizeof(T));
+        return (T*)pool->alloc(ilog2<1>(bytes));
+    }
+    void deallocate(T* p, std::size_t n) {
+        size_t bytes = std::max(2 * sizeof(void*), n * sizeof(T));
+        pool->free(ilog2<1>(bytes), p);
+    }
+    template <typename U>
+    bool operator==(const threaded_retail_allocator<U, BlockAllocator>& rhs) const {
+        return pool == rhs.pool;
+    }
+    template <typename U>
+    bool operator!=(const threaded_retail_allocator<U, BlockAllocator>& rhs) const {
+        return pool != rhs.pool;
+    }
+    std::shared_ptr<Pool> pool;
+};
+
 template <typename Derived>
 struct base_allocator {
     std::vector<MemBlock> blocks;
@@ -0,0 +1,72 @@
+#include "BranchProfile.h"
+#include <algorithm>
+#include <vector>
+
+void BranchProfile::add(const PerfSampler::Table &table) {
+    for (const PerfSampler::Sample &sample : table.samples) {
+        // A sample without a branch stack may point past the end
+        if (sample.numbranches == 0) continue;
+        const PerfSampler::Branch *stack = table.branches.data() + sample.stack;
+        for (uint32_t j = 0; j < sample.numbranches; ++j) {
+            const PerfSampler::Branch &newer(stack[j]);
+            Branch &branch(_branches[newer.from]);
+            branch.taken++;
+            if (newer.mispredicted) branch.mispredicted++;
+
+            // The oldest entry has no previous branch to delimit its block
+            if (j + 1 == sample.numbranches) continue;
+            if (newer.cycles == 0) continue;
+            const PerfSampler::Branch &older(stack[j + 1]);
+            _blocks[BlockKey(older.to, newer.from)].add(newer.cycles);
+        }
+    }
+}
+
+void BranchProfile::clear() {
+    _blocks.clear();
+    _branches.clear();
+}
+
+const std::map<BranchProfile::BlockKey, BranchProfile::Histogram> &BranchProfile::blocks()
+    const {
+    return _blocks;
+}
+
+const std::map<uint64_t, BranchProfile::Branch> &BranchProfile::branches() const {
+    return _branches;
+}
+
+void BranchProfile::print(std::ostream &out, size_t top) const {
+    char line[256];
+
+    // Hottest blocks by total cycles
+    std::vector<std::pair<double, const BlockKey *>> hot;
+    for (const auto &ib : _blocks) {
+        hot.emplace_back(ib.second.average() * ib.second.count(), &ib.first);
+    }
+    std::sort(hot.begin(), hot.end(),
+              [](const auto &lhs, const auto &rhs) { return lhs.first > rhs.first; });
+    out << "Basic blocks by cycles (count, cycles p50/p99):\n";
+    for (size_t j = 0; j < std::min(top, hot.size()); ++j) {
+        const BlockKey &key(*hot[j].second);
+        const Histogram &hist(_blocks.at(key));
+        snprintf(line, sizeof(line), "   0x%016lx-0x%016lx %8lu %6.1f %6.1f  ", key.first,
+                 key.second, hist.count(), hist.percentile(50), hist.percentile(99));
+        out << line << symbol_name(key.first) << "\n";
+    }
+
+    // Branches by number of mispredictions
+    std::vector<std::pair<uint64_t, Branch>> missed(_branches.begin(), _branches.end());
+    std::sort(missed.begin(), missed.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.second.mispredicted > rhs.second.mispredicted;
+    });
+    out << "Branches by mispredictions (taken, mispredicted, ratio):\n";
+    for (size_t j = 0; j < std::min(top, missed.size()); ++j) {
+        const Branch &branch(missed[j].second);
+        if (branch.mispredicted == 0) break;
+        snprintf(line, sizeof(line), "   0x%016lx %8lu %8lu %5.1f%%  ", missed[j].first,
+                 branch.taken, branch.mispredicted,
+                 (100.0 * branch.mispredicted) / branch.taken);
+        out << line << symbol_name(missed[j].first) << "\n";
+    }
+}
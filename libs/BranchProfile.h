@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <utility>
+#include "MicroStats.h"
+#include "PerfSampler.h"
+
+/** Decodes the branch stacks captured by PerfSampler (Options::branches).
+ * Two consecutive taken branches delimit a basic block: it starts at the
+ * target of the older branch and ends at the source of the newer one, which
+ * also carries the number of cycles spent in between. Those cycles are kept
+ * in a MicroStats histogram per block. Each branch source also keeps how
+ * many times it was taken and mispredicted.
+ */
+class BranchProfile {
+public:
+    using Histogram = MicroStats<2>;
+
+    //! Address range [from,to] executed between two taken branches
+    using BlockKey = std::pair<uint64_t, uint64_t>;
+
+    //! Taken/mispredicted counts of one branch instruction
+    struct Branch {
+        uint64_t taken = 0;
+        uint64_t mispredicted = 0;
+    };
+
+    //! Adds all branch stacks in a sampled section
+    void add(const PerfSampler::Table &table);
+
+    void clear();
+
+    const std::map<BlockKey, Histogram> &blocks() const;
+    const std::map<uint64_t, Branch> &branches() const;
+
+    //! Prints the blocks with most cycles and the most mispredicted branches
+    void print(std::ostream &out, size_t top = 10) const;
+
+private:
+    std::map<BlockKey, Histogram> _blocks;
+    std::map<uint64_t, Branch> _branches;
+};
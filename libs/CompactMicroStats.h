@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <type_traits>
+#include "MicroStats.h"
+
+/**
+ * Same semilog binning as MicroStats but storing only a dense array of
+ * counts, with the bin ranges computed on demand from calcrange(). With
+ * 32-bit counts MicroStats<8> shrinks from about 560KB to 56KB, so the
+ * part touched by add() stays in L1/L2. Set SUMS to also keep the per-bin
+ * sum and sum of squares in separate arrays, only read by queries.
+ */
+template <uint32_t NDB, bool SUMS = false, typename CountType = uint32_t>
+class CompactMicroStats {
+public:
+    using Layout = MicroStats<NDB>;
+    static constexpr uint32_t NUMBINS = Layout::NUMBINS;
+
+    CompactMicroStats() {
+        clear();
+    }
+
+    //! Adds a value to the histogram
+    void add(uint64_t value) {
+        uint32_t binnum = Layout::calcbin(value);
+        counts[binnum]++;
+        if constexpr (SUMS) {
+            sums.sum[binnum] += value;
+            sums.sum2[binnum] += double(value) * value;
+        }
+        totalcount += 1;
+        totalsum += value;
+    }
+
+    //! Adds many values at once, see MicroStats::add(const uint64_t*, size_t)
+    void add(const uint64_t* values, std::size_t n,
+             microstats::SimdLevel level = microstats::detect()) {
+        constexpr std::size_t BLOCK = 256;
+        uint32_t binnums[BLOCK];
+        for (std::size_t start = 0; start < n; start += BLOCK) {
+            std::size_t size = std::min(BLOCK, n - start);
+            const uint64_t* block = values + start;
+            microstats::calcbins<NDB>(block, binnums, size, level);
+            double total[4] = {0, 0, 0, 0};
+            for (std::size_t j = 0; j < size; ++j) {
+                double value = block[j];
+                counts[binnums[j]]++;
+                if constexpr (SUMS) {
+                    sums.sum[binnums[j]] += value;
+                    sums.sum2[binnums[j]] += value * value;
+                }
+                total[j & 3] += value;
+            }
+            totalcount += size;
+            totalsum += (total[0] + total[1]) + (total[2] + total[3]);
+        }
+    }
+
+    //! Clears the histogram
+    void clear() {
+        counts.fill(0);
+        sums.clear();
+        totalcount = 0;
+        totalsum = 0;
+    }
+
+    //! Adds all the values of another histogram to this one
+    void merge(const CompactMicroStats& other) {
+        for (uint32_t j = 0; j < NUMBINS; ++j) counts[j] += other.counts[j];
+        sums.merge(other.sums);
+        totalcount += other.totalcount;
+        totalsum += other.totalsum;
+    }
+
+    //! Returns the respective percentile value, interpolated from the bin
+    //! moments with SUMS and uniform within each bin otherwise
+    double percentile(double pct) const {
+        if (totalcount == 0) return 0;
+        double goal = std::max(pct * totalcount / 100.0, 0.5);
+        uint64_t count = 0;
+        for (uint32_t j = 0; j < NUMBINS; ++j) {
+            uint64_t bincount = counts[j];
+            if (count + bincount >= goal) {
+                typename Layout::Range range = Layout::calcrange(j);
+                double ratio = (goal - count) / bincount;
+                if constexpr (SUMS) {
+                    double value = percentile::interpolate(
+                        range.from - 0.5, range.to + 0.5, bincount, sums.sum[j],
+                        sums.sum2[j] + bincount / 12.0, ratio);
+                    return std::min<double>(range.to,
+                                            std::max<double>(range.from, value));
+                }
+                return percentile::uniform(range.from, range.to, ratio);
+            }
+            count += bincount;
+        }
+        return -1;
+    }
+
+    //! Number of values in the given bin
+    uint64_t bincount(uint32_t binnum) const {
+        return counts[binnum];
+    }
+
+    //! Average of the values in the given bin, only with SUMS
+    double binaverage(uint32_t binnum) const {
+        static_assert(SUMS, "Per-bin sums are not kept");
+        return counts[binnum] == 0 ? 0 : sums.sum[binnum] / counts[binnum];
+    }
+
+    //! Returns the number of events
+    uint64_t count() const {
+        return totalcount;
+    }
+
+    //! Returns the global average
+    double average() const {
+        return totalsum / totalcount;
+    }
+
+    //! Prints the histogram's values as percentiles
+    void print(std::ostream& oss) const {
+        for (double v : {1, 10, 25, 50, 75, 90, 99}) {
+            oss << v << "%," << percentile(v) << ",";
+        }
+    }
+
+    friend inline std::ostream& operator<<(std::ostream& out,
+                                           const CompactMicroStats& ms) {
+        ms.print(out);
+        return out;
+    }
+
+private:
+    struct Sums {
+        std::array<double, NUMBINS> sum;
+        std::array<double, NUMBINS> sum2;
+        void clear() {
+            sum.fill(0);
+            sum2.fill(0);
+        }
+        void merge(const Sums& other) {
+            for (uint32_t j = 0; j < NUMBINS; ++j) {
+                sum[j] += other.sum[j];
+                sum2[j] += other.sum2[j];
+            }
+        }
+    };
+    struct NoSums {
+        void clear() {
+        }
+        void merge(const NoSums&) {
+        }
+    };
+
+    std::array<CountType, NUMBINS> counts;  //! Dense counts, the only hot data
+    double totalsum = 0;                    //! Total sum of all values inserted
+    uint64_t totalcount = 0;                //! Total count of all values inserted
+    typename std::conditional<SUMS, Sums, NoSums>::type sums;
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "MicroStats.h"
+
+/**
+ * Small dense id of the calling thread. Live threads always hold distinct
+ * ids, and a thread hands its id back when it exits so the next thread
+ * reuses the lowest free one.
+ */
+class ThreadToken {
+public:
+    static uint32_t get() {
+        thread_local ThreadToken token;
+        return token.id;
+    }
+
+private:
+    struct Pool {
+        std::mutex mutex;
+        std::vector<uint32_t> free;  //! Min-heap of released ids
+        uint32_t size = 0;
+    };
+    //! Never destroyed, threads may exit during static destruction
+    static Pool& pool() {
+        static Pool* pool = new Pool();
+        return *pool;
+    }
+    ThreadToken() {
+        Pool& p(pool());
+        std::lock_guard<std::mutex> lock(p.mutex);
+        if (p.free.empty()) {
+            id = p.size++;
+        } else {
+            std::pop_heap(p.free.begin(), p.free.end(), std::greater<uint32_t>());
+            id = p.free.back();
+            p.free.pop_back();
+        }
+    }
+    ~ThreadToken() {
+        Pool& p(pool());
+        std::lock_guard<std::mutex> lock(p.mutex);
+        p.free.push_back(id);
+        std::push_heap(p.free.begin(), p.free.end(), std::greater<uint32_t>());
+    }
+    uint32_t id;
+};
+
+/**
+ * A MicroStats that many threads can add to at once without locks.
+ * Bins are sharded by ThreadToken: the thread holding token j is the only
+ * writer of shard j, so it updates it with plain relaxed stores, and
+ * shards are cache-line aligned so concurrent producers never share lines.
+ * When a thread exits its token, and with it the shard, goes to the next
+ * thread. Threads beyond the number of shards fall back to an overflow
+ * shard updated with atomic read-modify-writes. Readers merge all shards
+ * into a regular MicroStats on demand.
+ */
+template <uint32_t NDB>
+class ConcurrentMicroStats {
+public:
+    using Stats = MicroStats<NDB>;
+    static constexpr uint32_t NUMBINS = Stats::NUMBINS;
+
+    //! Creates one shard per hardware thread unless told otherwise
+    explicit ConcurrentMicroStats(std::size_t numshards = 0) : overflow(new Shard()) {
+        if (numshards == 0) numshards = std::thread::hardware_concurrency();
+        if (numshards == 0) numshards = 1;
+        shards.reserve(numshards);
+        for (std::size_t j = 0; j < numshards; ++j) {
+            shards.emplace_back(new Shard());
+        }
+    }
+
+    //! Adds a value from any thread
+    void add(uint64_t value) {
+        uint32_t me = ThreadToken::get();
+        if (me < shards.size()) {
+            shards[me]->addOwned(value);
+        } else {
+            overflow->addShared(value);
+        }
+    }
+
+    //! Merges all shards. Values being added meanwhile may or may not show up.
+    Stats snapshot() const {
+        Stats stats;
+        for (const auto& shard : shards) shard->mergeInto(stats);
+        overflow->mergeInto(stats);
+        return stats;
+    }
+
+    double percentile(double pct) const {
+        return snapshot().percentile(pct);
+    }
+
+    uint64_t count() const {
+        uint64_t total = overflow->count();
+        for (const auto& shard : shards) total += shard->count();
+        return total;
+    }
+
+    //! Resets all bins. Not safe while other threads are adding.
+    void clear() {
+        for (auto& shard : shards) shard->clear();
+        overflow->clear();
+    }
+
+private:
+    struct Cell {
+        std::atomic<uint64_t> count{0};
+        std::atomic<double> sum{0};
+        std::atomic<double> sum2{0};
+    };
+
+    //! Allocated on its own, aligned and padded to whole cache lines
+    struct alignas(64) Shard {
+        Cell cells[NUMBINS];
+
+        //! Only the owner writes, so a load and a store are enough
+        void addOwned(uint64_t value) {
+            Cell& cell(cells[Stats::calcbin(value)]);
+            double v = value;
+            cell.count.store(cell.count.load(std::memory_order_relaxed) + 1,
+                             std::memory_order_relaxed);
+            cell.sum.store(cell.sum.load(std::memory_order_relaxed) + v,
+                           std::memory_order_relaxed);
+            cell.sum2.store(cell.sum2.load(std::memory_order_relaxed) + v * v,
+                            std::memory_order_relaxed);
+        }
+        void addShared(uint64_t value) {
+            Cell& cell(cells[Stats::calcbin(value)]);
+            double v = value;
+            cell.count.fetch_add(1, std::memory_order_relaxed);
+            fetch_add(cell.sum, v);
+            fetch_add(cell.sum2, v * v);
+        }
+        static void fetch_add(std::atomic<double>& target, double v) {
+            double old = target.load(std::memory_order_relaxed);
+            while (!target.compare_exchange_weak(old, old + v,
+                                                 std::memory_order_relaxed)) {
+            }
+        }
+        void mergeInto(Stats& stats) const {
+            for (uint32_t j = 0; j < NUMBINS; ++j) {
+                uint64_t count = cells[j].count.load(std::memory_order_relaxed);
+                if (count == 0) continue;
+                stats.merge(j, count, cells[j].sum.load(std::memory_order_relaxed),
+                            cells[j].sum2.load(std::memory_order_relaxed));
+            }
+        }
+        uint64_t count() const {
+            uint64_t total = 0;
+            for (uint32_t j = 0; j < NUMBINS; ++j) {
+                total += cells[j].count.load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+        void clear() {
+            for (uint32_t j = 0; j < NUMBINS; ++j) {
+                cells[j].count.store(0, std::memory_order_relaxed);
+                cells[j].sum.store(0, std::memory_order_relaxed);
+                cells[j].sum2.store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::unique_ptr<Shard> overflow;
+};
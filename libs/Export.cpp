@@ -0,0 +1,285 @@
+#include "Export.h"
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+
+//! Appends formatted fields to a buffer, flushed to the stream in big blocks
+class CsvBuffer {
+public:
+    CsvBuffer(std::ostream &out) : _out(out) {
+        _buffer.reserve(FLUSHSIZE + 256);
+    }
+    ~CsvBuffer() {
+        flush();
+    }
+    //! Text fields are quoted when they hold a separator, a quote or a newline,
+    //! with inner quotes doubled
+    void add(const std::string &text) {
+        if (text.find_first_of(",\"\r\n") == std::string::npos) {
+            _buffer.append(text);
+        } else {
+            _buffer.push_back('"');
+            for (char ch : text) {
+                if (ch == '"') _buffer.push_back('"');
+                _buffer.push_back(ch);
+            }
+            _buffer.push_back('"');
+        }
+        _buffer.push_back(',');
+    }
+    template <typename T>
+    void add(T value) {
+        char temp[64];
+        auto res = std::to_chars(temp, temp + sizeof(temp), value);
+        _buffer.append(temp, res.ptr);
+        _buffer.push_back(',');
+    }
+    void endl() {
+        // Replaces the last separator
+        if (!_buffer.empty() && (_buffer.back() == ',')) _buffer.pop_back();
+        _buffer.push_back('\n');
+        if (_buffer.size() >= FLUSHSIZE) flush();
+    }
+    void flush() {
+        _out.write(_buffer.data(), _buffer.size());
+        _buffer.clear();
+    }
+
+private:
+    static constexpr std::size_t FLUSHSIZE = 1 << 20;
+    std::ostream &_out;
+    std::string _buffer;
+};
+
+/** Writes a columnar table straight to the stream, one column at a time,
+ * so the data is never copied into a second table in memory. All the
+ * dictionary codes must be known before begin(). After that each column()
+ * must be followed by exactly numrows values.
+ */
+class ColumnWriter {
+public:
+    enum Type : uint8_t { Code = 1, UInt64 = 2, Float64 = 3 };
+
+    ColumnWriter(std::ostream &out, uint64_t numrows) : _out(out), _numrows(numrows) {
+        _buffer.reserve(FLUSHSIZE);
+    }
+    ~ColumnWriter() {
+        flush();
+    }
+    uint32_t code(const std::string &text) {
+        auto it = _codes.find(text);
+        if (it != _codes.end()) return it->second;
+        _dictionary.push_back(text);
+        return _codes[text] = _dictionary.size() - 1;
+    }
+    //! Writes the header and the dictionary
+    void begin(uint32_t numcolumns) {
+        put("TPCF", 4);
+        put<uint32_t>(1);
+        put<uint64_t>(_numrows);
+        put<uint32_t>(numcolumns);
+        put<uint32_t>(_dictionary.size());
+        for (const std::string &text : _dictionary) putstring(text);
+    }
+    void column(const std::string &name, Type type) {
+        static const std::size_t sizes[] = {0, sizeof(uint32_t), sizeof(uint64_t),
+                                            sizeof(double)};
+        putstring(name);
+        put<uint8_t>(type);
+        put<uint64_t>(_numrows * sizes[type]);
+    }
+    template <typename T>
+    void put(T value) {
+        put(&value, 1);
+    }
+    template <typename T>
+    void put(const T *values, std::size_t count) {
+        std::size_t size = count * sizeof(T);
+        if (_buffer.size() + size > FLUSHSIZE) flush();
+        if (size >= FLUSHSIZE) {
+            _out.write(reinterpret_cast<const char *>(values), size);
+        } else {
+            _buffer.append(reinterpret_cast<const char *>(values), size);
+        }
+    }
+    template <typename T>
+    void fill(T value, std::size_t count) {
+        for (std::size_t j = 0; j < count; ++j) put(value);
+    }
+    bool finish() {
+        flush();
+        return bool(_out);
+    }
+
+private:
+    static constexpr std::size_t FLUSHSIZE = 1 << 16;
+    void putstring(const std::string &text) {
+        put<uint32_t>(text.size());
+        put(text.data(), text.size());
+    }
+    void flush() {
+        _out.write(_buffer.data(), _buffer.size());
+        _buffer.clear();
+    }
+    std::ostream &_out;
+    uint64_t _numrows;
+    std::string _buffer;
+    std::vector<std::string> _dictionary;
+    std::unordered_map<std::string, uint32_t> _codes;
+};
+
+// Union of the metric names of all events, in order of first appearance
+std::vector<std::string> metric_names(const Snapshot::EventMap &events) {
+    std::vector<std::string> names;
+    for (const auto &ism : events) {
+        for (const Snapshot::Metric &metric : ism.second.metrics) {
+            bool found = false;
+            for (const std::string &name : names) {
+                if (name == metric.name) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) names.push_back(metric.name);
+        }
+    }
+    return names;
+}
+
+// Metric of the event with the given name, nullptr if missing
+const Snapshot::Metric *find_metric(const Snapshot::Event &event,
+                                    const std::string &name) {
+    for (const Snapshot::Metric &metric : event.metrics) {
+        if (metric.name == name) return &metric;
+    }
+    return nullptr;
+}
+
+}  // namespace
+
+bool write_csv(const Snapshot::EventMap &events, std::ostream &out) {
+    std::vector<std::string> names = metric_names(events);
+    CsvBuffer csv(out);
+    csv.add(std::string("event"));
+    csv.add(std::string("N"));
+    for (const std::string &name : names) csv.add(name);
+    csv.endl();
+    std::vector<const Snapshot::Metric *> metrics(names.size());
+    for (const auto &ism : events) {
+        const Snapshot::Event &event(ism.second);
+        for (size_t k = 0; k < names.size(); ++k) {
+            metrics[k] = find_metric(event, names[k]);
+        }
+        for (size_t row = 0; row < event.N.size(); ++row) {
+            csv.add(event.name);
+            csv.add(uint64_t(event.N[row]));
+            for (const Snapshot::Metric *metric : metrics) {
+                if (metric == nullptr) {
+                    csv.add(std::string());
+                } else {
+                    csv.add(metric->values[row]);
+                }
+            }
+            csv.endl();
+        }
+    }
+    csv.flush();
+    return bool(out);
+}
+
+bool write_columns(const Snapshot::EventMap &events, std::ostream &out) {
+    std::vector<std::string> names = metric_names(events);
+    uint64_t numrows = 0;
+    for (const auto &ism : events) numrows += ism.second.N.size();
+
+    ColumnWriter table(out, numrows);
+    for (const auto &ism : events) table.code(ism.second.name);
+    table.begin(2 + names.size());
+    table.column("event", ColumnWriter::Code);
+    for (const auto &ism : events) {
+        table.fill(table.code(ism.second.name), ism.second.N.size());
+    }
+    table.column("N", ColumnWriter::UInt64);
+    for (const auto &ism : events) {
+        for (size_t n : ism.second.N) table.put<uint64_t>(n);
+    }
+    for (const std::string &name : names) {
+        table.column(name, ColumnWriter::Float64);
+        for (const auto &ism : events) {
+            const Snapshot::Event &event(ism.second);
+            const Snapshot::Metric *metric = find_metric(event, name);
+            if (metric == nullptr) {
+                table.fill(std::numeric_limits<double>::quiet_NaN(), event.N.size());
+            } else {
+                table.put(metric->values.data(), event.N.size());
+            }
+        }
+    }
+    return table.finish();
+}
+
+bool write_csv(const std::vector<Model> &models, std::ostream &out) {
+    CsvBuffer csv(out);
+    for (const char *name :
+         {"event", "complexity", "term", "coef", "pval", "rsq", "fpval", "loglik", "aic",
+          "bic"}) {
+        csv.add(std::string(name));
+    }
+    csv.endl();
+    for (const Model &model : models) {
+        for (const Coefficient &coef : model.coefficients) {
+            csv.add(model.event);
+            csv.add(model.complexity);
+            csv.add(coef.name);
+            csv.add(coef.coef);
+            csv.add(coef.pval);
+            csv.add(model.rsq);
+            csv.add(model.fpval);
+            csv.add(model.loglik);
+            csv.add(model.aic);
+            csv.add(model.bic);
+            csv.endl();
+        }
+    }
+    csv.flush();
+    return bool(out);
+}
+
+bool write_columns(const std::vector<Model> &models, std::ostream &out) {
+    uint64_t numrows = 0;
+    for (const Model &model : models) numrows += model.coefficients.size();
+    ColumnWriter table(out, numrows);
+    for (const Model &model : models) {
+        table.code(model.event);
+        table.code(model.complexity);
+        for (const Coefficient &coef : model.coefficients) table.code(coef.name);
+    }
+    table.begin(10);
+    // Writes one column, taking each row's value from the model and coefficient
+    auto column = [&](const char *name, ColumnWriter::Type type, auto &&value) {
+        table.column(name, type);
+        for (const Model &model : models) {
+            for (const Coefficient &coef : model.coefficients) {
+                table.put(value(model, coef));
+            }
+        }
+    };
+    using M = const Model &;
+    using C = const Coefficient &;
+    column("event", ColumnWriter::Code, [&](M m, C) { return table.code(m.event); });
+    column("complexity", ColumnWriter::Code,
+           [&](M m, C) { return table.code(m.complexity); });
+    column("term", ColumnWriter::Code, [&](M, C c) { return table.code(c.name); });
+    column("coef", ColumnWriter::Float64, [](M, C c) { return c.coef; });
+    column("pval", ColumnWriter::Float64, [](M, C c) { return c.pval; });
+    column("rsq", ColumnWriter::Float64, [](M m, C) { return m.rsq; });
+    column("fpval", ColumnWriter::Float64, [](M m, C) { return m.fpval; });
+    column("loglik", ColumnWriter::Float64, [](M m, C) { return m.loglik; });
+    column("aic", ColumnWriter::Float64, [](M m, C) { return m.aic; });
+    column("bic", ColumnWriter::Float64, [](M m, C) { return m.bic; });
+    return table.finish();
+}
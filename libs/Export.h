@@ -0,0 +1,30 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Snapshot.h"
+#include "Regression.h"
+
+/** Bulk export of Snapshot results and fitted models for external tools.
+ *
+ * The CSV writers format into a large buffer with std::to_chars, which avoids
+ * the per-row iostream overhead. Text fields holding a comma, a quote or a
+ * newline are quoted, with inner quotes doubled.
+ *
+ * The columnar writers emit a small binary format, stored column by column:
+ *   header:     "TPCF", u32 version, u64 numrows, u32 numcolumns
+ *   dictionary: u32 count, then count x (u32 length, bytes)
+ *   columns:    numcolumns x (u32 length, name, u8 type, u64 bytes, data)
+ * where type is 1 for u32 dictionary codes, 2 for u64 and 3 for f64.
+ * Column data is the raw little-endian array, streamed straight from the
+ * samples without building the table in memory first.
+ *
+ * Sample tables have the columns event (dictionary), N, then one f64
+ * column per metric, with NaN where an event lacks that metric.
+ * Model tables have one row per coefficient: event, complexity and term
+ * (dictionary), then coef, pval, rsq, fpval, loglik, aic and bic.
+ */
+bool write_csv(const Snapshot::EventMap &events, std::ostream &out);
+bool write_columns(const Snapshot::EventMap &events, std::ostream &out);
+bool write_csv(const std::vector<Model> &models, std::ostream &out);
+bool write_columns(const std::vector<Model> &models, std::ostream &out);
@@ -1,28 +1,15 @@
 #pragma once
 
 #include "KahanSum.h"
+#include "Percentile.h"
 
 #include <cstdint>
 #include <cmath>
 #include <iostream>
 #include <limits>
 #include <array>
-
-//! Computes the approximation of the inverse CDF for a given p-value
-static inline double invcdf(double p) {
-    auto approx = [](double t) {
-        // Abramowitz and Stegun formula 26.2.23.
-        // The absolute value of the error should be less than 4.5 e-4.
-        double c[] = {2.515517, 0.802853, 0.010328};
-        double d[] = {1.432788, 0.189269, 0.001308};
-        return t - ((c[2] * t + c[1]) * t + c[0]) /
-                       (((d[2] * t + d[1]) * t + d[0]) * t + 1.0);
-    };
-    if (p < 0) return -std::numeric_limits<double>::infinity();
-    if (p > 1) return std::numeric_limits<double>::infinity();
-    if (p < 0.5) return -approx(std::sqrt(-2.0 * std::log(p)));
-    return approx(std::sqrt(-2.0 * std::log(1 - p)));
-}
+#include <algorithm>
+#include <type_traits>
 
 template <std::uint32_t NUMBINS>
 class Histogram {
@@ -67,22 +54,18 @@ public:
             const Bin& bin(_bins[j]);
             if (bin.count == 0) continue;
             if (count + bin.count >= pctval) {
-                double excess = pctval - count;
-                double ratio = excess / bin.count;
-                double avg = bin.sum() / bin.count;
-                double avg2 = bin.sum2() / bin.count;
-                double stdev = ::sqrt(avg2 - avg * avg);
-                double sigma = invcdf(ratio);
-                double pctx = avg + sigma * stdev;
-                if (pctx < limit(j)) return limit(j);
-                if (pctx > limit(j + 1)) return limit(j + 1);
-                return pctx;
-                // return ratio*limit(j+1) + (1-ratio)*limit(j);
+                double ratio = (pctval - count) / bin.count;
+                return percentile::interpolate(limit(j), limit(j + 1), bin.count,
+                                               bin.sum(), bin.sum2(), ratio);
             }
             count += bin.count;
         }
         return std::numeric_limits<double>::quiet_NaN();
     }
+    //! Same as pct(), under the name MicroStats uses
+    double percentile(double percent) const {
+        return pct(percent);
+    }
     friend std::ostream& operator<<(std::ostream& oss, const Histogram<NUMBINS>& h) {
         h.print(oss);
         return oss;
@@ -102,3 +85,164 @@ private:
     double _min;
     double _max;
 };
+
+/**
+ * Drop-in for Histogram that is cheap enough to sit inside timing loops.
+ * The bin is found with a multiply by a precomputed reciprocal and
+ * min/max clamping, which compile to branchless code. Integer ticks get a
+ * first guess in fixed-point arithmetic, which is then moved to the bin
+ * add() would pick by comparing with the integer bin edges, so both paths
+ * bin alike even when min or max are not integers. The per-bin moments are
+ * plain doubles. With DEFERRED, add() only bumps the count and queues the
+ * value; the queue is folded into Kahan sums every 256 values and before
+ * every query. That keeps Histogram's accuracy for a higher total cost.
+ */
+template <std::uint32_t NUMBINS, bool DEFERRED = false>
+class FastHistogram {
+public:
+    FastHistogram(double min, double max)
+        : _min(min),
+          _max(max),
+          _scale(NUMBINS / (max - min)),
+          _imin(min > 0 ? std::uint64_t(min) : 0),
+          _ispan(std::uint64_t(std::max(max, 1.0)) - _imin),
+          _imult(((std::uint64_t(NUMBINS) << 32) + _ispan - 1) /
+                 std::max<std::uint64_t>(_ispan, 1)) {
+        initEdges();
+        clear();
+    }
+    void clear() {
+        for (Bin& bin : _bins) {
+            bin.count = 0;
+            bin.sum.clear();
+            bin.sum2.clear();
+        }
+        _pending.size = 0;
+    }
+    void add(double value) {
+        insert(binof(value), value);
+    }
+    //! Adds an integer such as a tic() difference, in the same bin as add()
+    void addTicks(std::uint64_t ticks) {
+        std::uint64_t offset = ticks > _imin ? ticks - _imin : 0;
+        offset = std::min(offset, _ispan);
+        std::uint32_t idx = std::min<std::uint64_t>((offset * _imult) >> 32, NUMBINS - 1);
+        // The guess is off by at most a bin unless bins are under a tick wide
+        while (ticks < _edges[idx]) --idx;
+        while ((idx + 1 < NUMBINS) && (ticks >= _edges[idx + 1])) ++idx;
+        insert(idx, double(ticks));
+    }
+    double limit(std::uint32_t idx) const {
+        return idx * (_max - _min) / NUMBINS + _min;
+    }
+    //! Number of values in the given bin
+    std::uint64_t bincount(std::uint32_t idx) const {
+        return _bins[idx].count;
+    }
+    double pct(double percent) const {
+        flush();
+        std::uint64_t total = 0;
+        for (const Bin& bin : _bins) total += bin.count;
+        if (total == 0) return std::numeric_limits<double>::quiet_NaN();
+        double pctval = (percent * total) / 100;
+        std::uint64_t count = 0;
+        for (std::uint32_t j = 0; j < NUMBINS; ++j) {
+            const Bin& bin(_bins[j]);
+            if (bin.count == 0) continue;
+            if (count + bin.count >= pctval) {
+                double ratio = (pctval - count) / bin.count;
+                return percentile::interpolate(limit(j), limit(j + 1), bin.count,
+                                               bin.sum(), bin.sum2(), ratio);
+            }
+            count += bin.count;
+        }
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    double percentile(double percent) const {
+        return pct(percent);
+    }
+    friend std::ostream& operator<<(std::ostream& oss, const FastHistogram& h) {
+        h.print(oss);
+        return oss;
+    }
+    void print(std::ostream& oss) const {
+        for (double v : {10, 25, 50, 75, 90, 95, 99}) {
+            oss << v << "%," << pct(v) << ",";
+        }
+    }
+
+private:
+    std::uint32_t binof(double value) const {
+        double x = std::min(std::max((value - _min) * _scale, 0.0), double(NUMBINS - 1));
+        return std::uint32_t(x);
+    }
+    //! Finds, for every bin, the smallest integer that add() puts there or above
+    void initEdges() {
+        constexpr std::uint64_t NOEDGE = std::numeric_limits<std::uint64_t>::max();
+        _edges[0] = 0;
+        for (std::uint32_t k = 1; k < NUMBINS; ++k) {
+            double x = std::ceil(_min + k / _scale);
+            std::uint64_t edge = x <= 0 ? 0 : x >= 0x1p64 ? NOEDGE : std::uint64_t(x);
+            // Rounding may leave the edge a step away from where add() switches
+            if ((edge > 0) && (binof(edge - 1) >= k)) --edge;
+            if ((edge < NOEDGE) && (binof(edge) < k)) ++edge;
+            _edges[k] = std::max(edge, _edges[k - 1]);
+        }
+        _edges[NUMBINS] = NOEDGE;
+    }
+    void insert(std::uint32_t idx, double value) {
+        Bin& bin(_bins[idx]);
+        bin.count += 1;
+        if (DEFERRED) {
+            _pending.values[_pending.size] = value;
+            _pending.bins[_pending.size] = idx;
+            if (++_pending.size == PENDING) flush();
+        } else {
+            bin.sum.add(value);
+            bin.sum2.add(value * value);
+        }
+    }
+    //! Folds the queued values into the bin moments
+    void flush() const {
+        for (std::uint32_t j = 0; j < _pending.size; ++j) {
+            Bin& bin(_bins[_pending.bins[j]]);
+            double value = _pending.values[j];
+            bin.sum.add(value);
+            bin.sum2.add(value * value);
+        }
+        _pending.size = 0;
+    }
+    static constexpr std::uint32_t PENDING = DEFERRED ? 256 : 1;
+    //! Plain double with the KahanSum interface
+    struct PlainSum {
+        double value;
+        void clear() {
+            value = 0;
+        }
+        void add(double v) {
+            value += v;
+        }
+        double operator()() const {
+            return value;
+        }
+    };
+    using Sum = typename std::conditional<DEFERRED, KahanSum<double>, PlainSum>::type;
+    struct Bin {
+        std::uint64_t count;
+        Sum sum, sum2;
+    };
+    struct Pending {
+        std::uint32_t size = 0;
+        std::uint32_t bins[PENDING];
+        double values[PENDING];
+    };
+    mutable std::array<Bin, NUMBINS> _bins;
+    mutable Pending _pending;
+    double _min;
+    double _max;
+    double _scale;             //! Bins per unit, so add() multiplies
+    std::uint64_t _imin;       //! Integer version of the range for addTicks()
+    std::uint64_t _ispan;
+    std::uint64_t _imult;      //! Bins per tick in 32.32 fixed point, rounded up
+    std::array<std::uint64_t, NUMBINS + 1> _edges;  //! First integer of each bin
+};
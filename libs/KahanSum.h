@@ -1,5 +1,138 @@
 #pragma once
 
+#include <cmath>
+#include <cstddef>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define KAHAN_X86_DISPATCH 1
+#endif
+
+/**
+ * Batch compensated summation over arrays. The serial Kahan loop is one
+ * long dependency chain; these kernels keep several independent
+ * accumulators, in SIMD lanes when available, and only combine them at the
+ * end. Results are returned as a sum and a compensation term whose total is
+ * the accurate value.
+ */
+namespace kahan {
+
+struct Result {
+    double sum;
+    double compensation;
+    double operator()() const {
+        return sum + compensation;
+    }
+};
+
+//! One Kahan-Babuska (Neumaier) step, which unlike Kahan stays accurate
+//! when the new value is larger than the running sum
+inline void neumaier(double& sum, double& compensation, double value) {
+    double t = sum + value;
+    if (std::fabs(sum) >= std::fabs(value)) {
+        compensation += (sum - t) + value;
+    } else {
+        compensation += (value - t) + sum;
+    }
+    sum = t;
+}
+
+//! Folds per-lane accumulators into one result
+inline Result combine(const double* sums, const double* compensations,
+                      std::size_t lanes) {
+    Result result{0, 0};
+    for (std::size_t j = 0; j < lanes; ++j) {
+        neumaier(result.sum, result.compensation, sums[j]);
+        result.compensation += compensations[j];
+    }
+    return result;
+}
+
+//! Neumaier summation with four interleaved scalar accumulators
+inline Result neumaier_sum_scalar(const double* values, std::size_t n) {
+    constexpr std::size_t LANES = 4;
+    double sums[LANES] = {0, 0, 0, 0};
+    double compensations[LANES] = {0, 0, 0, 0};
+    std::size_t j = 0;
+    for (; j + LANES <= n; j += LANES) {
+        for (std::size_t k = 0; k < LANES; ++k) {
+            neumaier(sums[k], compensations[k], values[j + k]);
+        }
+    }
+    for (; j < n; ++j) neumaier(sums[0], compensations[0], values[j]);
+    return combine(sums, compensations, LANES);
+}
+
+#ifdef KAHAN_X86_DISPATCH
+
+//! Neumaier summation in two sets of four AVX2 lanes
+__attribute__((target("avx2"))) inline Result neumaier_sum_avx2(const double* values,
+                                                                std::size_t n) {
+    const __m256d signbit = _mm256_set1_pd(-0.0);
+    __m256d sum[2] = {_mm256_setzero_pd(), _mm256_setzero_pd()};
+    __m256d comp[2] = {_mm256_setzero_pd(), _mm256_setzero_pd()};
+    std::size_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        for (int k = 0; k < 2; ++k) {
+            __m256d x = _mm256_loadu_pd(values + j + 4 * k);
+            __m256d t = _mm256_add_pd(sum[k], x);
+            __m256d sumisbig = _mm256_cmp_pd(_mm256_andnot_pd(signbit, sum[k]),
+                                             _mm256_andnot_pd(signbit, x), _CMP_GE_OQ);
+            __m256d big = _mm256_blendv_pd(x, sum[k], sumisbig);
+            __m256d small = _mm256_blendv_pd(sum[k], x, sumisbig);
+            comp[k] = _mm256_add_pd(comp[k], _mm256_add_pd(_mm256_sub_pd(big, t), small));
+            sum[k] = t;
+        }
+    }
+    double sums[9];
+    double compensations[9];
+    _mm256_storeu_pd(sums, sum[0]);
+    _mm256_storeu_pd(sums + 4, sum[1]);
+    _mm256_storeu_pd(compensations, comp[0]);
+    _mm256_storeu_pd(compensations + 4, comp[1]);
+    Result tail = neumaier_sum_scalar(values + j, n - j);
+    sums[8] = tail.sum;
+    compensations[8] = tail.compensation;
+    return combine(sums, compensations, 9);
+}
+
+inline bool has_avx2() {
+    static const bool supported = []() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+    return supported;
+}
+
+#endif
+
+//! Neumaier summation with the widest kernel the CPU supports
+inline Result neumaier_sum(const double* values, std::size_t n) {
+#ifdef KAHAN_X86_DISPATCH
+    if (has_avx2()) return neumaier_sum_avx2(values, n);
+#endif
+    return neumaier_sum_scalar(values, n);
+}
+
+/** Pairwise summation: blocks are summed plainly with eight accumulators
+ * and the block sums added as a balanced tree, so the error grows with
+ * log(n) instead of n. Cheaper than Neumaier but not as tight.
+ */
+inline double pairwise_sum(const double* values, std::size_t n) {
+    constexpr std::size_t BLOCK = 256;
+    if (n <= BLOCK) {
+        double sums[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        for (std::size_t j = 0; j < n; ++j) sums[j % 8] += values[j];
+        return ((sums[0] + sums[1]) + (sums[2] + sums[3])) +
+               ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+    }
+    // Split on a block boundary so the leaves stay full blocks
+    std::size_t half = ((n / 2 + BLOCK - 1) / BLOCK) * BLOCK;
+    return pairwise_sum(values, half) + pairwise_sum(values + half, n - half);
+}
+
+}  // namespace kahan
+
 /** Produces a sum with minimal rounding errors.
  * This should be done automatically when summing on loops but it's not done
  * when done in updates like in online statistics.
@@ -25,6 +158,13 @@ public:
         _sum = t;
     }
 
+    //! Adds an array of values, with the batch kernels of namespace kahan
+    inline void add(const double* values, std::size_t n) {
+        kahan::Result partial = kahan::neumaier_sum(values, n);
+        add(partial.sum);
+        add(partial.compensation);
+    }
+
     //! Returns the current sum
     inline T operator()() const {
         return _sum;
@@ -5,6 +5,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <cstdio>
+#include <cerrno>
 #include <array>
 
 
@@ -14,15 +16,23 @@ MMapFile::MMapFile()
 {}
 
 MMapFile::~MMapFile() {
+    close();
+}
+
+void MMapFile::close()
+{
     if (_fid>=0) {
-        // Close and remove
         ::munmap( _ptr, _mapsize );
         ::close(_fid);
     }
+    _fid = -1;
+    _ptr = nullptr;
+    _mapsize = 0;
 }
 
 bool MMapFile::init( const std::string& name, uint32_t size )
 {
+    close();
     int fid = ::shm_open( name.c_str(), O_CREAT|O_RDWR, S_IRWXU|S_IRWXG );
     if ( fid<0 ) {
         int err_no = errno;
@@ -43,12 +53,16 @@ bool MMapFile::init( const std::string& name, uint32_t size )
         return false;
     }
 
-    // Memory map file
+    // Memory map file, locked if RLIMIT_MEMLOCK allows it
     void* ptr = mmap( NULL, mapsize, PROT_READ|PROT_WRITE,
                       MAP_SHARED|MAP_LOCKED, fid, 0 );
+    if ( ptr == MAP_FAILED ) {
+        ptr = mmap( NULL, mapsize, PROT_READ|PROT_WRITE, MAP_SHARED, fid, 0 );
+    }
     if ( ptr == MAP_FAILED ) {
         int err_no = errno;
         fprintf( stderr, "Cannot memory map file: %s\n", strerror(err_no) );
+        ::close( fid );
         return false;
     }
     ::memset( ptr, 0, mapsize );
@@ -59,6 +73,40 @@ bool MMapFile::init( const std::string& name, uint32_t size )
     return true;
 }
 
+bool MMapFile::open( const std::string& name, bool readonly )
+{
+    close();
+    int fid = ::shm_open( name.c_str(), readonly ? O_RDONLY : O_RDWR, 0 );
+    if ( fid<0 ) {
+        int err_no = errno;
+        fprintf( stderr, "Cannot open file [%s]: %s\n",
+                 name.c_str(), strerror(err_no) );
+        return false;
+    }
+
+    struct stat st;
+    if ( (::fstat( fid, &st )<0) || (st.st_size==0) ) {
+        fprintf( stderr, "Shared mem file %s is empty\n", name.c_str() );
+        ::close( fid );
+        return false;
+    }
+
+    const uint32_t mapsize = st.st_size;
+    void* ptr = mmap( NULL, mapsize, readonly ? PROT_READ : PROT_READ|PROT_WRITE,
+                      MAP_SHARED, fid, 0 );
+    if ( ptr == MAP_FAILED ) {
+        int err_no = errno;
+        fprintf( stderr, "Cannot memory map file: %s\n", strerror(err_no) );
+        ::close( fid );
+        return false;
+    }
+
+    _fid = fid;
+    _ptr = ptr;
+    _mapsize = mapsize;
+    return true;
+}
+
 bool MMapFile::unlink( const std::string& name )
 {
     int res = ::shm_unlink( name.c_str() );
@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+class MMapFile {
+public:
+    MMapFile();
+    ~MMapFile();
+    //! Creates (or resets) the shared memory file, zeroed and locked in memory
+    //! when RLIMIT_MEMLOCK allows it. Any previous mapping is released first.
+    bool init( const std::string& name, uint32_t size );
+    //! Maps an existing shared memory file in full, as created by init()
+    bool open( const std::string& name, bool readonly = true );
+    //! Unmaps and closes the file, which stays in /dev/shm
+    void close();
+    void* data() const { return _ptr; }
+    uint32_t size() const { return _mapsize; }
+    static bool unlink( const std::string& name );
+private:
+    int _fid;
+    void* _ptr;
+    uint32_t _mapsize;
+};
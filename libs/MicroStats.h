@@ -3,6 +3,11 @@
 #include <cstdint>
 #include <array>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "MicroStatsBatch.h"
+#include "Percentile.h"
 
 #if defined(__GNUC__) && defined(__x86_64__)
 //! Returns the most significant bit
@@ -55,6 +60,33 @@ public:
         totalsum += value;
     }
 
+    /** Adds many values at once. Bin numbers are computed with SIMD one
+     * block at a time, so the scatter loop that follows only carries the
+     * load-add-store of each bin and successive updates can overlap.
+     */
+    void add(const uint64_t* values, std::size_t n,
+             microstats::SimdLevel level = microstats::detect()) {
+        constexpr std::size_t BLOCK = 256;
+        uint32_t binnums[BLOCK];
+        for (std::size_t start = 0; start < n; start += BLOCK) {
+            std::size_t size = std::min(BLOCK, n - start);
+            const uint64_t* block = values + start;
+            microstats::calcbins<NDB>(block, binnums, size, level);
+            // Four partial totals so the additions do not form one long chain
+            double total[4] = {0, 0, 0, 0};
+            for (std::size_t j = 0; j < size; ++j) {
+                Bin& bin(bins[binnums[j]]);
+                double value = block[j];
+                bin.count++;
+                bin.sum += value;
+                bin.sum2 += value * value;
+                total[j & 3] += value;
+            }
+            totalcount += size;
+            totalsum += (total[0] + total[1]) + (total[2] + total[3]);
+        }
+    }
+
     //! Clears the histogram
     void clear() {
         for (uint32_t j = 0; j < bins.size(); ++j) {
@@ -65,33 +97,165 @@ public:
         totalsum = 0;
     }
 
-    //! Returns the respective percentile value
+    //! Adds all the values of another histogram to this one
+    void merge(const MicroStats& other) {
+        for (uint32_t j = 0; j < bins.size(); ++j) {
+            bins[j].merge(other.bins[j]);
+        }
+        totalcount += other.totalcount;
+        totalsum += other.totalsum;
+    }
+
+    //! Adds statistics gathered elsewhere for the given bin
+    void merge(uint32_t binnum, uint64_t count, double sum, double sum2) {
+        Bin& bin(bins[binnum]);
+        bin.count += count;
+        bin.sum += sum;
+        bin.sum2 += sum2;
+        totalcount += count;
+        totalsum += sum;
+    }
+
+    /** Appends a compact encoding of the histogram to out: a short header
+     * then, for each non-empty bin only, the varint distance from the
+     * previous one and the varint count. The bin sums and sums of squares
+     * are written as raw doubles only if withsums is set, otherwise they are
+     * rebuilt from the bin midpoints on decoding. The global sum is always
+     * kept so average() is exact either way.
+     */
+    void serialize(std::vector<uint8_t>& out, bool withsums = false) const {
+        uint32_t used = 0;
+        for (const Bin& bin : bins) used += bin.count > 0;
+        out.push_back(FORMAT | (withsums ? WITHSUMS : 0));
+        out.push_back(NDB);
+        putvarint(out, used);
+        putdouble(out, totalsum);
+        uint32_t previous = 0;
+        for (uint32_t j = 0; j < bins.size(); ++j) {
+            const Bin& bin(bins[j]);
+            if (bin.count == 0) continue;
+            putvarint(out, j - previous);
+            putvarint(out, bin.count);
+            if (withsums) {
+                putdouble(out, bin.sum);
+                putdouble(out, bin.sum2);
+            }
+            previous = j;
+        }
+    }
+
+    //! Adds a histogram encoded by serialize() to this one. Returns the
+    //! number of bytes consumed, so encodings can be concatenated, or zero
+    //! if the data is malformed, in which case nothing is added.
+    std::size_t merge(const uint8_t* data, std::size_t size) {
+        const uint8_t* ptr = data;
+        const uint8_t* end = data + size;
+        if ((size < 2) || ((ptr[0] & ~WITHSUMS) != FORMAT) || (ptr[1] != NDB)) {
+            std::cerr << "MicroStats: not an encoded MicroStats<" << NDB << ">\n";
+            return 0;
+        }
+        bool withsums = (ptr[0] & WITHSUMS) != 0;
+        ptr += 2;
+        uint64_t used;
+        double sum;
+        if (!getvarint(ptr, end, used) || !getdouble(ptr, end, sum)) return 0;
+        // Decode into a scratch list first so a truncated buffer adds nothing
+        struct Entry {
+            uint32_t binnum;
+            uint64_t count;
+            double sum;
+            double sum2;
+        };
+        std::vector<Entry> entries;
+        entries.reserve(std::min<uint64_t>(used, bins.size()));
+        uint64_t binnum = 0;
+        for (uint64_t j = 0; j < used; ++j) {
+            uint64_t delta;
+            Entry entry{0, 0, 0, 0};
+            if (!getvarint(ptr, end, delta)) return 0;
+            if (!getvarint(ptr, end, entry.count)) return 0;
+            binnum += delta;
+            if (binnum >= bins.size()) return 0;
+            entry.binnum = binnum;
+            if (withsums) {
+                if (!getdouble(ptr, end, entry.sum) || !getdouble(ptr, end, entry.sum2)) {
+                    return 0;
+                }
+            } else {
+                const Range& range(bins[binnum].range);
+                double middle = (range.from + range.to) / 2.0;
+                entry.sum = entry.count * middle;
+                entry.sum2 = entry.sum * middle;
+            }
+            entries.push_back(entry);
+        }
+        for (const Entry& entry : entries) {
+            Bin& bin(bins[entry.binnum]);
+            bin.count += entry.count;
+            bin.sum += entry.sum;
+            bin.sum2 += entry.sum2;
+            totalcount += entry.count;
+        }
+        totalsum += sum;
+        return ptr - data;
+    }
+
+    //! Replaces the contents with a histogram encoded by serialize()
+    bool deserialize(const uint8_t* data, std::size_t size) {
+        clear();
+        return merge(data, size) != 0;
+    }
+
+    /** Returns the respective percentile value. The bin is found with one
+     * pass over the running counts, and the value is placed within the bin
+     * from its moments (see percentile::interpolate). Nothing is cached, so
+     * concurrent readers of a histogram that is not being written are safe.
+     */
     double percentile(double pct) const {
-        double goal = pct * totalcount / 100.0;
+        double value;
+        percentiles(&pct, &value, 1);
+        return value;
+    }
+
+    //! Same as percentile() for n ranks in increasing order, all answered
+    //! in a single pass over the bins
+    void percentiles(const double* pcts, double* out, std::size_t n) const {
         uint64_t count = 0;
-        uint32_t index = 0;
-        for (const Bin& bin : bins) {
-            if (count + bin.count >= goal) {
-                if (bin.count == 0) {
-                    // just send the middle
-                    return (bin.range.from + bin.range.to) / 2;
-                }
-                // This assumes a uniform distribution
-                double excess = goal - count;
-                double ratio = excess / bin.count;
-                double res = bin.range.to * ratio + bin.range.from * (1.0 - ratio);
-                return res;
+        uint32_t j = 0;
+        for (std::size_t k = 0; k < n; ++k) {
+            if (totalcount == 0) {
+                out[k] = 0;
+                continue;
             }
-            count += bin.count;
+            // Ranks at or below zero belong to the first non-empty bin
+            double goal = std::max(pcts[k] * totalcount / 100.0, 0.5);
+            while ((j < NUMBINS) && (count + bins[j].count < goal)) {
+                count += bins[j].count;
+                ++j;
+            }
+            // Bad luck
+            if (j >= NUMBINS) {
+                out[k] = -1;
+                continue;
+            }
+            const Bin& bin(bins[j]);
+            double ratio = (goal - count) / bin.count;
+            // Integer values stand for the unit interval around them
+            double value = percentile::interpolate(
+                bin.range.from - 0.5, bin.range.to + 0.5, bin.count, bin.sum,
+                bin.sum2 + bin.count / 12.0, ratio);
+            out[k] = std::min<double>(bin.range.to,
+                                      std::max<double>(bin.range.from, value));
         }
-        // Bad luck
-        return -1;
     }
 
     //! Prints the histogram's values as percentiles
     void print(std::ostream& oss) const {
-        for (double v : {1, 10, 25, 50, 75, 90, 99}) {
-            oss << v << "%," << percentile(v) << ",";
+        static const double pcts[] = {1, 10, 25, 50, 75, 90, 99};
+        double values[7];
+        percentiles(pcts, values, 7);
+        for (uint32_t k = 0; k < 7; ++k) {
+            oss << pcts[k] << "%," << values[k] << ",";
         }
     }
 
@@ -124,6 +288,17 @@ public:
         return Range{base + offset, base + (base >> NDB) + offset - 1};
     }
 
+    //! Number of values in the given bin
+    uint64_t bincount(uint32_t binnum) const {
+        return bins[binnum].count;
+    }
+
+    //! Average of the values in the given bin
+    double binaverage(uint32_t binnum) const {
+        const Bin& bin(bins[binnum]);
+        return bin.count == 0 ? 0 : bin.sum / bin.count;
+    }
+
     //! Returns the number of events
     uint64_t count() const {
         return totalcount;
@@ -135,6 +310,37 @@ public:
     }
 
 private:
+    static constexpr uint8_t FORMAT = 0x10;    //! Version of the serialize() layout
+    static constexpr uint8_t WITHSUMS = 0x01;  //! Flag: per-bin sums follow counts
+
+    static void putvarint(std::vector<uint8_t>& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(uint8_t(value) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(uint8_t(value));
+    }
+    static bool getvarint(const uint8_t*& ptr, const uint8_t* end, uint64_t& value) {
+        value = 0;
+        for (uint32_t shift = 0; (ptr < end) && (shift < 64); shift += 7) {
+            uint8_t byte = *ptr++;
+            value |= uint64_t(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) return true;
+        }
+        return false;
+    }
+    static void putdouble(std::vector<uint8_t>& out, double value) {
+        uint8_t bytes[sizeof(double)];
+        ::memcpy(bytes, &value, sizeof(double));
+        out.insert(out.end(), bytes, bytes + sizeof(double));
+    }
+    static bool getdouble(const uint8_t*& ptr, const uint8_t* end, double& value) {
+        if (end - ptr < std::ptrdiff_t(sizeof(double))) return false;
+        ::memcpy(&value, ptr, sizeof(double));
+        ptr += sizeof(double);
+        return true;
+    }
+
     //! Initializes the histogram with the calculated ranges
     void init() {
         for (uint32_t j = 0; j < bins.size(); ++j) {
@@ -162,6 +368,11 @@ private:
             sum += value;
             sum2 += double(value) * value;
         }
+        void merge(const Bin& other) {
+            count += other.count;
+            sum += other.sum;
+            sum2 += other.sum2;
+        }
     };
 
     std::array<Bin, NUMBINS> bins;  //! Collection of bins
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define MICROSTATS_X86_DISPATCH 1
+#endif
+
+/**
+ * Vectorized computation of MicroStats bin numbers, the first half of the
+ * batch add(). The kernel is picked once at runtime from the CPU features
+ * so the same binary runs everywhere:
+ *   AVX-512 (F+CD): 8 lanes with vplzcntq and variable shifts
+ *   AVX2:           4 lanes, msb taken from a double's exponent
+ *   Scalar:         calcbin() per value
+ */
+namespace microstats {
+
+enum class SimdLevel { Scalar = 0, AVX2 = 1, AVX512 = 2 };
+
+//! Bin number of a value, same as MicroStats<NDB>::calcbin()
+template <uint32_t NDB>
+inline uint32_t calcbin(uint64_t value) {
+    if (value < (1 << NDB)) return value;
+    uint32_t numbits = 64 - __builtin_clzll(value);
+    uint64_t mantissa = (value >> (numbits - (NDB + 1))) & ((1 << NDB) - 1);
+    return ((numbits - NDB) << NDB) + mantissa;
+}
+
+template <uint32_t NDB>
+inline void calcbins_scalar(const uint64_t* values, uint32_t* bins, std::size_t n) {
+    for (std::size_t j = 0; j < n; ++j) bins[j] = calcbin<NDB>(values[j]);
+}
+
+#ifdef MICROSTATS_X86_DISPATCH
+
+template <uint32_t NDB>
+__attribute__((target("avx2"))) inline void calcbins_avx2(const uint64_t* values,
+                                                          uint32_t* bins, std::size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i low32 = _mm256_set1_epi64x(0xFFFFFFFFULL);
+    // 2^52 as a double: or-ing a 32-bit integer into its mantissa and
+    // subtracting 2^52 gives that integer as a double
+    const __m256i magic = _mm256_set1_epi64x(0x4330000000000000ULL);
+    const __m256i bias = _mm256_set1_epi64x(1022);
+    const __m256i thirtytwo = _mm256_set1_epi64x(32);
+    const __m256i mask = _mm256_set1_epi64x((1 << NDB) - 1);
+    const __m256i ndb = _mm256_set1_epi64x(NDB);
+    const __m256i ndb1 = _mm256_set1_epi64x(NDB + 1);
+    const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    std::size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + j));
+        // AVX2 has no 64-bit lzcnt. Take the upper half if it is not zero,
+        // else the lower one, and read its msb from the exponent of the
+        // double it converts to exactly. Zero gives a negative count.
+        __m256i upper = _mm256_srli_epi64(v, 32);
+        __m256i useupper = _mm256_cmpgt_epi64(upper, zero);
+        __m256i half = _mm256_blendv_epi8(_mm256_and_si256(v, low32), upper, useupper);
+        __m256d d = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(half, magic)),
+                                  _mm256_castsi256_pd(magic));
+        __m256i numbits = _mm256_add_epi64(
+            _mm256_sub_epi64(_mm256_srli_epi64(_mm256_castpd_si256(d), 52), bias),
+            _mm256_and_si256(useupper, thirtytwo));
+        __m256i shift = _mm256_sub_epi64(numbits, ndb1);
+        __m256i high = _mm256_add_epi64(
+            _mm256_slli_epi64(_mm256_sub_epi64(numbits, ndb), NDB),
+            _mm256_and_si256(_mm256_srlv_epi64(v, shift), mask));
+        __m256i large = _mm256_cmpgt_epi64(numbits, ndb);
+        __m256i bin = _mm256_blendv_epi8(v, high, large);
+        __m256i packed = _mm256_permutevar8x32_epi32(bin, pack);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(bins + j),
+                         _mm256_castsi256_si128(packed));
+    }
+    calcbins_scalar<NDB>(values + j, bins + j, n - j);
+}
+
+template <uint32_t NDB>
+__attribute__((target("avx512f,avx512cd"))) inline void calcbins_avx512(
+    const uint64_t* values, uint32_t* bins, std::size_t n) {
+    const __m512i sixtyfour = _mm512_set1_epi64(64);
+    const __m512i mask = _mm512_set1_epi64((1 << NDB) - 1);
+    const __m512i ndb = _mm512_set1_epi64(NDB);
+    const __m512i ndb1 = _mm512_set1_epi64(NDB + 1);
+    std::size_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m512i v = _mm512_loadu_si512(values + j);
+        __m512i numbits = _mm512_sub_epi64(sixtyfour, _mm512_lzcnt_epi64(v));
+        __m512i shift = _mm512_sub_epi64(numbits, ndb1);
+        __m512i high = _mm512_add_epi64(
+            _mm512_slli_epi64(_mm512_sub_epi64(numbits, ndb), NDB),
+            _mm512_and_si512(_mm512_srlv_epi64(v, shift), mask));
+        __mmask8 large = _mm512_cmpgt_epi64_mask(numbits, ndb);
+        __m512i bin = _mm512_mask_blend_epi64(large, v, high);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(bins + j),
+                            _mm512_cvtepi64_epi32(bin));
+    }
+    calcbins_scalar<NDB>(values + j, bins + j, n - j);
+}
+
+//! Best kernel the running CPU supports
+inline SimdLevel detect() {
+    static const SimdLevel level = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd")) {
+            return SimdLevel::AVX512;
+        }
+        if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+        return SimdLevel::Scalar;
+    }();
+    return level;
+}
+
+#else
+
+inline SimdLevel detect() {
+    return SimdLevel::Scalar;
+}
+
+#endif
+
+//! Computes the bin numbers of n values with the given kernel. Levels the
+//! CPU does not support fall back to the best one it does.
+template <uint32_t NDB>
+inline void calcbins(const uint64_t* values, uint32_t* bins, std::size_t n,
+                     SimdLevel level = detect()) {
+    if (level > detect()) level = detect();
+#ifdef MICROSTATS_X86_DISPATCH
+    if (level == SimdLevel::AVX512) return calcbins_avx512<NDB>(values, bins, n);
+    if (level == SimdLevel::AVX2) return calcbins_avx2<NDB>(values, bins, n);
+#endif
+    calcbins_scalar<NDB>(values, bins, n);
+}
+
+}  // namespace microstats
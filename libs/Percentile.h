@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+//! Computes the approximation of the inverse CDF for a given p-value
+static inline double invcdf(double p) {
+    auto approx = [](double t) {
+        // Abramowitz and Stegun formula 26.2.23.
+        // The absolute value of the error should be less than 4.5 e-4.
+        double c[] = {2.515517, 0.802853, 0.010328};
+        double d[] = {1.432788, 0.189269, 0.001308};
+        return t - ((c[2] * t + c[1]) * t + c[0]) /
+                       (((d[2] * t + d[1]) * t + d[0]) * t + 1.0);
+    };
+    if (p < 0) return -std::numeric_limits<double>::infinity();
+    if (p > 1) return std::numeric_limits<double>::infinity();
+    if (p < 0.5) return -approx(std::sqrt(-2.0 * std::log(p)));
+    return approx(std::sqrt(-2.0 * std::log(1 - p)));
+}
+
+/**
+ * Percentile estimation shared by the histograms. A query first finds the
+ * bin holding the requested rank, then places the value inside that bin
+ * from what the bin knows about its own values.
+ */
+namespace percentile {
+
+//! Value at the given fraction of a bin spanning [lo, hi), assuming the
+//! values are spread uniformly
+inline double uniform(double lo, double hi, double ratio) {
+    return hi * ratio + lo * (1.0 - ratio);
+}
+
+/** Value at the given fraction of a bin spanning [lo, hi) holding count
+ * values that add up to sum, and to sum2 when squared.
+ * Within a bin the density is usually close to a straight line, whose
+ * slope follows from how far the mean sits from the middle. When the
+ * variance is too small for any straight line, the values are bunched up
+ * and a normal curve with the bin's mean and variance fits better.
+ * Results are clamped to the bin.
+ */
+inline double interpolate(double lo, double hi, double count, double sum, double sum2,
+                          double ratio) {
+    if ((count <= 0) || (ratio <= 0)) return lo;
+    if (ratio >= 1) return hi;
+    double width = hi - lo;
+    double mean = sum / count;
+    double variance = std::max(0.0, sum2 / count - mean * mean);
+    // Shift of the mean from the middle, as a fraction of the width, and
+    // the slope of the density f(u) = 1 + slope*(u - 1/2) on u in [0, 1)
+    double shift = (mean - (lo + hi) / 2) / width;
+    double slope = 12 * shift;
+    double linearvar = (1.0 / 12 - slope * slope / 144) * width * width;
+    if ((std::fabs(shift) > 1.0 / 6) || (variance < 0.8 * linearvar)) {
+        if (variance == 0) return std::min(hi, std::max(lo, mean));
+        double value = mean + invcdf(ratio) * std::sqrt(variance);
+        return std::min(hi, std::max(lo, value));
+    }
+    // Solve the cumulative u + slope*(u^2 - u)/2 = ratio
+    double u = ratio;
+    if (std::fabs(slope) > 1E-9) {
+        double a = slope / 2;
+        double b = 1 - slope / 2;
+        u = (-b + std::sqrt(b * b + 4 * a * ratio)) / (2 * a);
+    }
+    return lo + u * width;
+}
+
+//! First bin whose running count or weight reaches goal, skipping empty
+//! bins, or numbins if goal is beyond the total
+template <typename CountType>
+inline uint32_t locate(const CountType* cumulative, uint32_t numbins, double goal) {
+    // Ranks at or below zero belong to the first non-empty bin
+    if (goal <= 0) {
+        return std::upper_bound(cumulative, cumulative + numbins, CountType(0)) -
+               cumulative;
+    }
+    return std::lower_bound(cumulative, cumulative + numbins, goal) - cumulative;
+}
+
+}  // namespace percentile
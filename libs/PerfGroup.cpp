@@ -5,13 +5,13 @@
 #include <algorithm>
 #include <unordered_map>
 #include <limits>
+#include <sys/mman.h>
 
 // https://sources.debian.org/src/libpfm4/4.11.1+git32-gd0b85fb-1/perf_examples/self_count.c/
 // https://stackoverflow.com/questions/42088515/perf-event-open-how-to-monitoring-multiple-events
 // https://github.com/wcohen/libpfm4/blob/6864dad7cf85fac9fff04bd814026e2fbc160175/perf_examples/self.c
 
 PerfGroup::PerfGroup() {
-    initialize_libpfm();
 }
 
 PerfGroup::~PerfGroup() {
@@ -20,96 +20,312 @@ PerfGroup::~PerfGroup() {
 
 void PerfGroup::close() {
     for (Descriptor &d : _ids) {
-        ::close(d.fd);
+        if (d.page != nullptr) ::munmap(d.page, ::getpagesize());
+        if (d.fd >= 0) ::close(d.fd);
     }
     _ids.clear();
+    _groups.clear();
+    _order.clear();
+    _names.clear();
+    _numevents = 0;
 }
 
-static bool init(std::vector<perf_event_attr> &evds,
-                 std::vector<PerfGroup::Descriptor> &ids, std::vector<int> &leaders) {
-    pid_t pid = 0;  // getpid();
-    int cpu = -1;
-    int leader = -1;
-    int flags = 0;
-    int counter = 0;
-    leaders.clear();
-    for (size_t j = 0; j < evds.size(); ++j) {
-        perf_event_attr &pea(evds[j]);
-        pea.disabled = (leader < 0) ? 1 : 0;
-        pea.inherit = 1;
-        pea.pinned = (leader < 0) ? 1 : 0;
-        pea.size = sizeof(perf_event_attr);
-        pea.exclude_kernel = 1;
-        pea.exclude_user = 0;
-        pea.exclude_hv = 1;
-        pea.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
-
-    retry:
-        int fd = -1;
-        static const int kNumberOfTries = 5;
-        for (int k = 0; k < kNumberOfTries; ++k) {
-            fd = perf_event_open(&pea, pid, cpu, leader, flags);
-            if (fd >= 0) break;
+// Software events do not take a PMU counter
+static bool is_hardware(const perf_event_attr &pea) {
+    return (pea.type != PERF_TYPE_SOFTWARE) && (pea.type != PERF_TYPE_TRACEPOINT) &&
+           (pea.type != PERF_TYPE_BREAKPOINT);
+}
+
+// Splits the events into groups that fit in the PMU counters so that
+// events within a group are always counted together. Related events are
+// placed as a unit, everything else goes first-fit in the requested order.
+static std::vector<std::vector<size_t>> plan(
+    const std::vector<perf_event_attr> &evds,
+    const std::vector<PerfGroup::Descriptor> &ids,
+    const std::vector<std::vector<std::string>> &related, const PmuCapacity &cap) {
+    size_t numevents = evds.size();
+
+    // Merge the related sets that share events (union-find)
+    std::vector<size_t> parent(numevents);
+    for (size_t j = 0; j < numevents; ++j) parent[j] = j;
+    auto find = [&parent](size_t j) {
+        while (parent[j] != j) j = parent[j] = parent[parent[j]];
+        return j;
+    };
+    std::unordered_map<std::string, size_t> index;
+    for (size_t j = 0; j < numevents; ++j) index.emplace(ids[j].name, j);
+    for (const auto &names : related) {
+        size_t root = numevents;
+        for (const std::string &name : names) {
+            auto it = index.find(name);
+            if (it == index.end()) {
+                std::cerr << "PerfGroup::init related event [" << name
+                          << "] is not in the event list\n";
+                continue;
+            }
+            if (root == numevents)
+                root = find(it->second);
+            else
+                parent[find(it->second)] = root;
         }
-        if (fd < 0) {
-            if (leader >= 0) {
-                leader = -1;
-                goto retry;
+    }
+
+    // Clusters are kept in order of first appearance
+    std::vector<std::vector<size_t>> clusters;
+    std::unordered_map<size_t, size_t> cluster_index;
+    for (size_t j = 0; j < numevents; ++j) {
+        auto res = cluster_index.emplace(find(j), clusters.size());
+        if (res.second) clusters.emplace_back();
+        clusters[res.first->second].push_back(j);
+    }
+
+    struct Bin {
+        int general = 0;
+        uint32_t fixed = 0;  // bitmask of used fixed counters
+        std::vector<size_t> events;
+    };
+    int maxgeneral = std::max(cap.general, 1);
+    auto add = [&evds, &cap, maxgeneral](Bin &bin, size_t j) {
+        const perf_event_attr &pea(evds[j]);
+        if (is_hardware(pea)) {
+            int fixed = fixed_counter_index(pea);
+            uint32_t mask = (fixed >= 0) ? (1U << fixed) : 0;
+            if ((fixed >= 0) && (fixed < cap.fixed) && ((bin.fixed & mask) == 0)) {
+                bin.fixed |= mask;
+            } else if (bin.general < maxgeneral) {
+                bin.general++;
+            } else {
+                return false;
             }
-            int err = errno;
-            std::cerr << "PerfGroup::init  Index:" << j << " errno:" << err << " "
-                      << strerror(err) << "\n";
-            return false;
         }
-        if (leader < 0) {
-            leader = fd;
-            leaders.push_back(fd);
+        bin.events.push_back(j);
+        return true;
+    };
+    auto place = [&add](Bin &bin, const std::vector<size_t> &events) {
+        Bin tmp(bin);
+        for (size_t j : events) {
+            if (!add(tmp, j)) return false;
         }
-        uint64_t id = 0;
-        int result = ::ioctl(fd, PERF_EVENT_IOC_ID, &id);
-        if (result < 0) {
-            int err = errno;
-            std::cerr << "PerfGroup::init ioctl(PERF_EVENT_IOC_ID) Index:" << j
-                      << " errno:" << err << " " << strerror(err) << "\n";
-            return false;
+        bin = tmp;
+        return true;
+    };
+
+    std::vector<Bin> bins;
+    for (const std::vector<size_t> &cluster : clusters) {
+        Bin empty;
+        std::vector<std::vector<size_t>> units;
+        if (place(empty, cluster)) {
+            units.push_back(cluster);
+        } else {
+            std::cerr << "PerfGroup::init related events";
+            for (size_t j : cluster) std::cerr << " " << ids[j].name;
+            std::cerr << " do not fit in one group and will be split\n";
+            for (size_t j : cluster) units.push_back({j});
+        }
+        for (const std::vector<size_t> &unit : units) {
+            bool placed = false;
+            for (Bin &bin : bins) {
+                if (place(bin, unit)) {
+                    placed = true;
+                    break;
+                }
+            }
+            if (!placed) {
+                bins.emplace_back();
+                place(bins.back(), unit);
+            }
         }
+    }
 
-        ids[j].fd = fd;
-        ids[j].id = id;
-        ids[j].order = j;
+    // Software events go last so a hardware event leads the group
+    std::vector<std::vector<size_t>> groups;
+    for (Bin &bin : bins) {
+        std::stable_partition(bin.events.begin(), bin.events.end(),
+                              [&evds](size_t j) { return is_hardware(evds[j]); });
+        groups.push_back(bin.events);
+    }
+    return groups;
+}
+
+static bool init(std::vector<perf_event_attr> &evds,
+                 std::vector<PerfGroup::Descriptor> &ids,
+                 const std::vector<std::vector<size_t>> &schedule,
+                 std::vector<PerfGroup::Group> &groups,
+                 const PerfGroup::Options &options) {
+    bool systemwide = !options.cpus.empty();
+    pid_t pid = systemwide ? -1 : 0;
+    int flags = 0;
+    size_t numevents = evds.size();
+    size_t numslots = systemwide ? options.cpus.size() : 1;
+    groups.clear();
+    for (size_t slot = 0; slot < numslots; ++slot) {
+        int cpu = systemwide ? int(options.cpus[slot]) : -1;
+        size_t firstgroup = groups.size();
+        for (const std::vector<size_t> &planned : schedule) {
+            int leader = -1;
+            for (size_t j : planned) {
+                perf_event_attr &pea(evds[j]);
+                PerfGroup::Descriptor &desc(ids[slot * numevents + j]);
+            retry:
+                pea.disabled = (leader < 0) ? 1 : 0;
+                // rdpmc reads the hardware counter of the current thread only
+                // and inherit does not apply to cpu-wide events
+                pea.inherit = (options.inherit && !options.rdpmc && !systemwide) ? 1 : 0;
+                // Only the first group is pinned. A pinned group that does not fit goes
+                // into error state while the others can be multiplexed and scaled back.
+                pea.pinned = (leader < 0) && (groups.size() == firstgroup) ? 1 : 0;
+                pea.size = sizeof(perf_event_attr);
+                pea.exclude_kernel = options.kernel ? 0 : 1;
+                pea.exclude_user = 0;
+                pea.exclude_hv = 1;
+                pea.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+                                  PERF_FORMAT_TOTAL_TIME_ENABLED |
+                                  PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+                int fd = -1;
+                static const int kNumberOfTries = 5;
+                for (int k = 0; k < kNumberOfTries; ++k) {
+                    fd = perf_event_open(&pea, pid, cpu, leader, flags);
+                    if (fd >= 0) break;
+                }
+                if (fd < 0) {
+                    // The plan was too optimistic, start a new group
+                    if (leader >= 0) {
+                        leader = -1;
+                        goto retry;
+                    }
+                    int err = errno;
+                    std::cerr << "PerfGroup::init  Index:" << j << " cpu:" << cpu
+                              << " errno:" << err << " " << strerror(err) << "\n";
+                    return false;
+                }
+                if (leader < 0) {
+                    leader = fd;
+                    groups.push_back(PerfGroup::Group{fd, cpu});
+                }
+                uint64_t id = 0;
+                int result = ::ioctl(fd, PERF_EVENT_IOC_ID, &id);
+                if (result < 0) {
+                    int err = errno;
+                    std::cerr << "PerfGroup::init ioctl(PERF_EVENT_IOC_ID) Index:" << j
+                              << " errno:" << err << " " << strerror(err) << "\n";
+                    return false;
+                }
+
+                desc.fd = fd;
+                desc.id = id;
+                desc.order = slot * numevents + j;
+                desc.group = groups.size() - 1;
+                desc.cpu = cpu;
+
+                if (options.rdpmc) {
+                    if (!is_hardware(pea)) {
+                        std::cerr << "PerfGroup::init Index:" << j << " [" << desc.name
+                                  << "] is not a hardware event and cannot use rdpmc\n";
+                        return false;
+                    }
+                    void *page =
+                        ::mmap(nullptr, ::getpagesize(), PROT_READ, MAP_SHARED, fd, 0);
+                    if (page == MAP_FAILED) {
+                        int err = errno;
+                        std::cerr << "PerfGroup::init mmap Index:" << j
+                                  << " errno:" << err << " " << strerror(err) << "\n";
+                        return false;
+                    }
+                    desc.page = (perf_event_mmap_page *)page;
+                }
+            }
+        }
     }
     return true;
 }
 
 bool PerfGroup::init(const std::vector<std::string> &events) {
+    return init(events, Options());
+}
+
+bool PerfGroup::init(const std::vector<std::string> &events, const Options &options) {
+    close();
+    _options = options;
+    if (_options.rdpmc && !_options.cpus.empty()) {
+        std::cerr << "PerfGroup::init rdpmc cannot read other cpus' counters\n";
+        return false;
+    }
+    _numevents = events.size();
     std::vector<perf_event_attr> evds(events.size());
     std::vector<const char *> names(events.size());
-    _ids.resize(events.size());
+    _ids.resize(events.size() * numSlots());
+    for (size_t j = 0; j < _ids.size(); ++j) {
+        _ids[j].name = events[j % _numevents];
+    }
     for (size_t j = 0; j < events.size(); ++j) {
         names[j] = events[j].c_str();
-        _ids[j].name = events[j];
     }
-    if (!translate(names.data(), evds.data(), events.size())) return false;
-    if (!::init(evds, _ids, _leaders)) return false;
+    if (!translate(names.data(), evds.data(), events.size())) {
+        close();
+        return false;
+    }
+    _capacity = get_pmu_capacity();
+    auto schedule = plan(evds, _ids, _options.related, _capacity);
+    if (!::init(evds, _ids, schedule, _groups, _options)) {
+        close();
+        return false;
+    }
     std::sort(_ids.begin(), _ids.end(), [](const Descriptor &lhs, const Descriptor &rhs) {
         return lhs.id < rhs.id;
     });
     _order.resize(_ids.size());
     for (size_t j = 0; j < _ids.size(); ++j) {
         _order[_ids[j].order] = j;
-        _names[_ids[j].name] = j;
+    }
+    for (size_t j = 0; j < _numevents; ++j) {
+        _names[events[j]] = j;
+    }
+    if (_options.rdpmc && !enableMapped()) {
+        close();
+        return false;
     }
     return true;
 }
 
+bool PerfGroup::enableMapped() {
+    // In rdpmc mode the counters run from now on and start()/stop() only
+    // sample them, so they have to be enabled once here
+    for (const Group &g : _groups) {
+        int res = ioctl(g.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        if (res < 0) {
+            int err = errno;
+            std::cerr << "PerfGroup::init ioctl(PERF_EVENT_IOC_ENABLE) errno:" << err
+                      << " " << strerror(err) << "\n";
+            return false;
+        }
+    }
+    for (const Descriptor &d : _ids) {
+        if (d.page->cap_user_rdpmc == 0) {
+            std::cerr << "PerfGroup::init rdpmc is not available for [" << d.name
+                      << "]. Check /sys/bus/event_source/devices/cpu/rdpmc\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+const PerfGroup::Options &PerfGroup::options() const {
+    return _options;
+}
+
 bool PerfGroup::start() {
     if (_ids.empty()) {
         std::cerr << "Group is empty!"
                   << "\n";
         return false;
     }
-    for (int lead : _leaders) {
-        int res = ioctl(lead, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    if (_options.rdpmc) {
+        for (Descriptor &d : _ids) d.base = read_mapped_counter(d.page);
+        return true;
+    }
+    for (const Group &g : _groups) {
+        int res = ioctl(g.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
         if (res < 0) {
             int err = errno;
             std::cerr << "PerfGroup::start ioctl(PERF_EVENT_IOC_RESET) errno:" << err
@@ -117,8 +333,8 @@ bool PerfGroup::start() {
             return false;
         }
     }
-    for (int lead : _leaders) {
-        int res = ioctl(lead, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    for (const Group &g : _groups) {
+        int res = ioctl(g.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
         if (res < 0) {
             int err = errno;
             std::cerr << "PerfGroup::init ioctl(PERF_EVENT_IOC_ENABLE) errno:" << err
@@ -135,8 +351,9 @@ bool PerfGroup::stop() {
                   << "\n";
         return false;
     }
-    for (int lead : _leaders) {
-        int res = ioctl(lead, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (_options.rdpmc) return sample();
+    for (const Group &g : _groups) {
+        int res = ioctl(g.leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
         if (res < 0) {
             int err = errno;
             std::cerr << "PerfGroup::init ioctl(PERF_EVENT_IOC_DISABLE) errno:" << err
@@ -148,22 +365,129 @@ bool PerfGroup::stop() {
     return true;
 }
 
+bool PerfGroup::sample() {
+    if (_ids.empty()) return false;
+    if (_options.rdpmc) {
+        for (Descriptor &d : _ids) {
+            MappedCount now = read_mapped_counter(d.page);
+            d.raw = now.value - d.base.value;
+            Group &g(_groups[d.group]);
+            g.enabled = now.enabled - d.base.enabled;
+            g.running = now.running - d.base.running;
+        }
+        scale();
+        return true;
+    }
+    read();
+    return true;
+}
+
 size_t PerfGroup::size() const {
-    return _ids.size();
+    return _numevents;
+}
+
+size_t PerfGroup::numSlots() const {
+    return _options.cpus.empty() ? 1 : _options.cpus.size();
+}
+
+const PerfGroup::Descriptor &PerfGroup::descriptor(size_t index, size_t cpuslot) const {
+    return _ids[_order[cpuslot * _numevents + index]];
 }
 
 uint64_t PerfGroup::operator[](size_t index) const {
-    return _ids[index].value;
+    uint64_t total = 0;
+    for (size_t slot = 0; slot < numSlots(); ++slot) {
+        total += descriptor(index, slot).value;
+    }
+    return total;
 }
 
 uint64_t PerfGroup::operator[](const char *name) const {
     auto it = _names.find(name);
     if (it == _names.end()) return std::numeric_limits<uint64_t>::max();
-    return _ids[it->second].value;
+    return (*this)[it->second];
+}
+
+size_t PerfGroup::index(const char *name) const {
+    auto it = _names.find(name);
+    if (it == _names.end()) return size();
+    return it->second;
 }
 
 std::string PerfGroup::name(size_t index) const {
-    return _ids[index].name;
+    return descriptor(index, 0).name;
+}
+
+uint64_t PerfGroup::raw(size_t index) const {
+    uint64_t total = 0;
+    for (size_t slot = 0; slot < numSlots(); ++slot) {
+        total += descriptor(index, slot).raw;
+    }
+    return total;
+}
+
+uint64_t PerfGroup::value(size_t index, size_t cpuslot) const {
+    return descriptor(index, cpuslot).value;
+}
+
+double PerfGroup::ratio(size_t index) const {
+    uint64_t enabled = 0;
+    uint64_t running = 0;
+    for (size_t slot = 0; slot < numSlots(); ++slot) {
+        const Group &g(_groups[descriptor(index, slot).group]);
+        enabled += g.enabled;
+        running += g.running;
+    }
+    if (enabled == 0) return 1;
+    return double(running) / enabled;
+}
+
+size_t PerfGroup::numGroups() const {
+    return _groups.size();
+}
+
+const PerfGroup::Group &PerfGroup::group(size_t index) const {
+    return _groups[index];
+}
+
+const PmuCapacity &PerfGroup::capacity() const {
+    return _capacity;
+}
+
+void PerfGroup::printSchedule(std::ostream &out) const {
+    out << "PerfGroup: " << _capacity.general << " general + " << _capacity.fixed
+        << " fixed counters" << (_capacity.watchdog ? " (nmi watchdog on)" : "") << "\n";
+    for (size_t g = 0; g < _groups.size(); ++g) {
+        out << "  Group " << g;
+        if (_groups[g].cpu >= 0) out << " (cpu " << _groups[g].cpu << ")";
+        out << ":";
+        for (size_t k = 0; k < _ids.size(); ++k) {
+            const Descriptor &d(_ids[_order[k]]);
+            if (d.group == g) out << " " << d.name;
+        }
+        if (_groups[g].enabled > 0)
+            out << "  (running " << _groups[g].ratio() * 100 << "%)";
+        out << "\n";
+    }
+}
+
+double PerfGroup::Group::ratio() const {
+    if (enabled == 0) return 1;
+    return double(running) / enabled;
+}
+
+void PerfGroup::scale() {
+    // Extrapolates the counts to the full enabled time, like perf stat does.
+    // A group that never got scheduled reads zero.
+    for (Descriptor &d : _ids) {
+        const Group &g(_groups[d.group]);
+        if (g.running == 0)
+            d.value = 0;
+        else if (g.running >= g.enabled)
+            d.value = d.raw;
+        else
+            d.value = uint64_t(double(d.raw) * g.enabled / g.running + 0.5);
+    }
 }
 
 void PerfGroup::read() {
@@ -175,14 +499,24 @@ void PerfGroup::read() {
     };
     struct Message {
         uint64_t nr;
+        uint64_t time_enabled;
+        uint64_t time_running;
         MessageValue values[];
     };
-    for (Descriptor &d : _ids) d.value = std::numeric_limits<uint64_t>::max();
+    for (Descriptor &d : _ids) d.raw = std::numeric_limits<uint64_t>::max();
     size_t bufsize = 2 * (sizeof(Message) + n * sizeof(MessageValue));
-    std::vector<uint8_t> buf(bufsize);
-    for (int lead : _leaders) {
-        ssize_t nb = ::read(lead, buf.data(), bufsize);
+    // Kept across calls so reading does not allocate
+    std::vector<uint8_t> &buf(_readbuf);
+    if (buf.size() < bufsize) buf.resize(bufsize);
+    for (Group &g : _groups) {
+        ssize_t nb = ::read(g.leader, buf.data(), bufsize);
+        if (nb < ssize_t(sizeof(Message))) {
+            g.enabled = g.running = 0;
+            continue;
+        }
         Message *msg = (Message *)buf.data();
+        g.enabled = msg->time_enabled;
+        g.running = msg->time_running;
         for (uint64_t i = 0; i < msg->nr; i++) {
             uint64_t id = msg->values[i].id;
             uint64_t value = msg->values[i].value;
@@ -193,11 +527,12 @@ void PerfGroup::read() {
                 [](const Descriptor &d, size_t id) { return d.id < id; });
             if (it != _ids.end()) {
                 if (id == it->id) {
-                    it->value = value;
+                    it->raw = value;
                 }
             } else {
                 std::cerr << "Not found id " << id << "\n";
             }
         }
     }
+    scale();
 }
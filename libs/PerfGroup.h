@@ -3,35 +3,112 @@
 #include <string>
 #include <cstdint>
 #include <unordered_map>
+#include <iostream>
 #include "PerfUtils.h"
 
 // https://stackoverflow.com/questions/42088515/perf-event-open-how-to-monitoring-multiple-events
 
 struct PerfGroup {
+    //! Tweaks how the events are opened and read
+    struct Options {
+        //! Keep the counters running and read them from userspace with rdpmc
+        //! through each event's mmap'd page. start()/stop() then issue no
+        //! syscalls but only the calling thread is counted (no inherit) and
+        //! software events are not supported.
+        bool rdpmc = false;
+
+        //! Also count the children created after init. This prevents grouped
+        //! reads on some kernels and should be off for per-thread counting.
+        bool inherit = true;
+
+        //! Sets of events that must be counted in the same group, typically a
+        //! ratio and its denominator like {"cycles", "stalled-cycles"}. Sets that
+        //! share an event are merged.
+        std::vector<std::vector<std::string>> related;
+
+        //! Count everything that runs on these cpus (pid=-1) instead of the
+        //! calling thread. The events are opened once per cpu and operator[]
+        //! returns the total, see value() for the per-cpu breakdown.
+        //! Requires perf_event_paranoid <= 0 or CAP_PERFMON.
+        std::vector<std::size_t> cpus;
+
+        //! Also count while in kernel mode, including interrupt handlers
+        bool kernel = false;
+    };
+
     PerfGroup();
     ~PerfGroup();
     bool init(const std::vector<std::string> &events);
+    bool init(const std::vector<std::string> &events, const Options &options);
     void close();
     bool start();
     bool stop();
 
+    //! Reads the counts accumulated since start() without stopping, so
+    //! nested regions can take deltas inside an enclosing start()/stop()
+    bool sample();
+
     size_t size() const;
     uint64_t operator[](size_t index) const;
     uint64_t operator[](const char *name) const;
     std::string name(size_t index) const;
+    //! Index of the named event, or size() if it is not in the group
+    size_t index(const char *name) const;
+    const Options &options() const;
+
+    //! Returns the unscaled counter value as read from the kernel
+    uint64_t raw(size_t index) const;
+
+    //! Returns the scaled value of an event on the n-th cpu of Options::cpus
+    uint64_t value(size_t index, size_t cpuslot) const;
+
+    //! Returns the fraction of the time the event's group was actually counting.
+    //! Anything below 1.0 means the kernel multiplexed the group and the value
+    //! returned by operator[] has been scaled up by the inverse of this ratio.
+    double ratio(size_t index) const;
+
+    //! A group of events that are scheduled together on the PMU
+    struct Group {
+        int leader;            //! File descriptor of the group leader
+        int cpu;               //! The cpu counted or -1 for the calling thread
+        uint64_t enabled = 0;  //! Time (ns) the group was enabled on last stop()
+        uint64_t running = 0;  //! Time (ns) the group was actually counting
+        double ratio() const;
+    };
+    size_t numGroups() const;
+    const Group &group(size_t index) const;
+
+    //! Returns the PMU counters the groups were planned against
+    const PmuCapacity &capacity() const;
+
+    //! Prints which events were scheduled in each group
+    void printSchedule(std::ostream &out) const;
 
     struct Descriptor {
         std::string name;
-        int fd;
+        int fd = -1;
         uint64_t id;
-        uint64_t value;
-        size_t order;
+        uint64_t value;  //! Value scaled by the group's enabled/running times
+        uint64_t raw;    //! Value as read from the kernel
+        size_t order;    //! Position in the event list, cpu slot major
+        size_t group;    //! Index into the group list
+        int cpu = -1;    //! The cpu counted or -1 for the calling thread
+        perf_event_mmap_page *page = nullptr;  //! mmap'd control page (rdpmc mode)
+        MappedCount base{};                    //! values at start (rdpmc mode)
     };
 
 private:
     void read();
-    std::vector<int> _leaders;
+    void scale();
+    bool enableMapped();
+    const Descriptor &descriptor(size_t index, size_t cpuslot) const;
+    size_t numSlots() const;
+    Options _options;
+    size_t _numevents = 0;
+    PmuCapacity _capacity{};
+    std::vector<Group> _groups;
     std::vector<Descriptor> _ids;
     std::vector<size_t> _order;
     std::unordered_map<std::string, size_t> _names;
+    std::vector<uint8_t> _readbuf;
 };
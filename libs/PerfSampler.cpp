@@ -0,0 +1,226 @@
+#include "PerfSampler.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <sys/mman.h>
+
+// https://man7.org/linux/man-pages/man2/perf_event_open.2.html  (MMAP layout)
+
+PerfSampler::PerfSampler() : _fd(-1), _page(nullptr), _mapsize(0) {
+}
+
+PerfSampler::~PerfSampler() {
+    close();
+}
+
+void PerfSampler::close() {
+    if (_page != nullptr) {
+        ::munmap(_page, _mapsize);
+        _page = nullptr;
+    }
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+bool PerfSampler::init(const std::string &event) {
+    return init(event, Options());
+}
+
+bool PerfSampler::init(const std::string &event, const Options &options) {
+    close();
+    _options = options;
+    if ((_options.pages == 0) || ((_options.pages & (_options.pages - 1)) != 0)) {
+        std::cerr << "PerfSampler::init number of pages must be a power of two\n";
+        return false;
+    }
+
+    perf_event_attr pea;
+    memset(&pea, 0, sizeof(pea));
+    const char *names[] = {event.c_str()};
+    if (!translate(names, &pea, 1)) return false;
+    pea.size = sizeof(perf_event_attr);
+    pea.disabled = 1;
+    pea.exclude_kernel = _options.kernel ? 0 : 1;
+    pea.exclude_hv = 1;
+    pea.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME;
+    if (_options.callchain) {
+        pea.sample_type |= PERF_SAMPLE_CALLCHAIN;
+        pea.exclude_callchain_kernel = 1;
+    }
+    if (_options.branches) {
+        // Requires a hardware event and LBR (or equivalent) support
+        pea.sample_type |= PERF_SAMPLE_BRANCH_STACK;
+        pea.branch_sample_type = PERF_SAMPLE_BRANCH_ANY;
+        pea.branch_sample_type |=
+            _options.kernel ? PERF_SAMPLE_BRANCH_KERNEL : PERF_SAMPLE_BRANCH_USER;
+    }
+    if (_options.period > 0) {
+        pea.sample_period = _options.period;
+    } else {
+        pea.freq = 1;
+        pea.sample_freq = _options.frequency;
+    }
+
+    int fd = perf_event_open(&pea, 0, -1, -1, 0);
+    if (fd < 0) {
+        int err = errno;
+        std::cerr << "PerfSampler::init [" << event << "] errno:" << err << " "
+                  << strerror(err) << "\n";
+        return false;
+    }
+
+    // One control page followed by the ring buffer
+    size_t mapsize = (1 + _options.pages) * ::getpagesize();
+    void *ptr = ::mmap(nullptr, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        int err = errno;
+        std::cerr << "PerfSampler::init mmap errno:" << err << " " << strerror(err)
+                  << "\n";
+        ::close(fd);
+        return false;
+    }
+    _fd = fd;
+    _page = (perf_event_mmap_page *)ptr;
+    _mapsize = mapsize;
+    return true;
+}
+
+bool PerfSampler::start() {
+    if (_fd < 0) return false;
+    drain(nullptr);
+    int res = ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+    if (res == 0) res = ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+    if (res < 0) {
+        int err = errno;
+        std::cerr << "PerfSampler::start errno:" << err << " " << strerror(err) << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool PerfSampler::stop(const char *name) {
+    if (_fd < 0) return false;
+    int res = ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (res < 0) {
+        int err = errno;
+        std::cerr << "PerfSampler::stop errno:" << err << " " << strerror(err) << "\n";
+        return false;
+    }
+    drain(&_samples[name]);
+    return true;
+}
+
+size_t PerfSampler::poll(const char *name) {
+    if (_fd < 0) return 0;
+    return drain(&_samples[name]);
+}
+
+const PerfSampler::SampleMap &PerfSampler::getSamples() const {
+    return _samples;
+}
+
+size_t PerfSampler::drain(Table *table) {
+    // The kernel is the producer: it advances data_head and we advance
+    // data_tail once the records are consumed
+    uint64_t pagesize = ::getpagesize();
+    uint64_t offset = _page->data_offset != 0 ? _page->data_offset : pagesize;
+    uint64_t size = _page->data_size != 0 ? _page->data_size : _options.pages * pagesize;
+    const uint8_t *base = (const uint8_t *)_page + offset;
+    uint64_t head = __atomic_load_n(&_page->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = _page->data_tail;
+    size_t count = 0;
+    while (tail < head) {
+        // Records can wrap around the end of the buffer
+        const uint8_t *ptr = base + (tail & (size - 1));
+        perf_event_header header;
+        uint64_t contiguous = size - (tail & (size - 1));
+        if (contiguous >= sizeof(header)) {
+            memcpy(&header, ptr, sizeof(header));
+        } else {
+            memcpy(&header, ptr, contiguous);
+            memcpy((uint8_t *)&header + contiguous, base, sizeof(header) - contiguous);
+        }
+        if (header.size == 0) break;
+        if (contiguous < header.size) {
+            _record.resize(header.size);
+            memcpy(_record.data(), ptr, contiguous);
+            memcpy(_record.data() + contiguous, base, header.size - contiguous);
+            ptr = _record.data();
+        }
+        tail += header.size;
+        if (table == nullptr) continue;
+
+        const uint64_t *body = (const uint64_t *)(ptr + sizeof(header));
+        if (header.type == PERF_RECORD_SAMPLE) {
+            // Fields come in the order of the sample_type bits
+            Sample sample;
+            sample.ip = *body++;
+            uint32_t pidtid[2];
+            memcpy(pidtid, body++, sizeof(pidtid));
+            sample.pid = pidtid[0];
+            sample.tid = pidtid[1];
+            sample.time = *body++;
+            sample.chain = table->callchains.size();
+            sample.depth = 0;
+            if (_options.callchain) {
+                uint64_t nr = *body++;
+                for (uint64_t j = 0; j < nr; ++j) {
+                    // Skip the PERF_CONTEXT_* markers
+                    if (body[j] >= PERF_CONTEXT_MAX) continue;
+                    table->callchains.push_back(body[j]);
+                    sample.depth++;
+                }
+                body += nr;
+            }
+            sample.stack = table->branches.size();
+            sample.numbranches = 0;
+            if (_options.branches) {
+                uint64_t nr = *body++;
+                for (uint64_t j = 0; j < nr; ++j) {
+                    perf_branch_entry entry;
+                    memcpy(&entry, body, sizeof(entry));
+                    body += sizeof(entry) / sizeof(uint64_t);
+                    Branch branch;
+                    branch.from = entry.from;
+                    branch.to = entry.to;
+                    branch.cycles = entry.cycles;
+                    branch.mispredicted = entry.mispred != 0;
+                    table->branches.push_back(branch);
+                }
+                sample.numbranches = nr;
+            }
+            table->samples.push_back(sample);
+            count++;
+        } else if (header.type == PERF_RECORD_LOST) {
+            // struct { u64 id; u64 lost; }
+            table->lost += body[1];
+        }
+    }
+    __atomic_store_n(&_page->data_tail, tail, __ATOMIC_RELEASE);
+    return count;
+}
+
+void PerfSampler::print(const std::string &name, std::ostream &out, size_t top) const {
+    auto it = _samples.find(name);
+    if (it == _samples.end()) {
+        out << "No samples for [" << name << "]\n";
+        return;
+    }
+    const Table &table(it->second);
+    std::unordered_map<uint64_t, uint64_t> hits;
+    for (const Sample &sample : table.samples) hits[sample.ip]++;
+    std::vector<std::pair<uint64_t, uint64_t>> sorted(hits.begin(), hits.end());
+    std::sort(sorted.begin(), sorted.end(),
+              [](const auto &lhs, const auto &rhs) { return lhs.second > rhs.second; });
+    out << name << ": " << table.samples.size() << " samples, " << table.lost
+        << " lost\n";
+    char line[256];
+    for (size_t j = 0; j < std::min(top, sorted.size()); ++j) {
+        uint64_t ip = sorted[j].first;
+        double pct = (100.0 * sorted[j].second) / table.samples.size();
+        snprintf(line, sizeof(line), "   %6.2f%%  0x%016lx  ", pct, ip);
+        out << line << symbol_name(ip) << "\n";
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "PerfUtils.h"
+
+/** Samples one event through perf_event_open's mmap'd ring buffer.
+ * Every period (or at the given frequency) the kernel writes a
+ * PERF_RECORD_SAMPLE with the instruction pointer, thread and time and
+ * optionally the callchain. The buffer is drained from userspace without
+ * syscalls on stop()/poll() and the samples are stored in a compact table
+ * under the name of the section being measured, typically the same name
+ * passed to Snapshot::stop(). See Snapshot::setSampler().
+ */
+class PerfSampler {
+public:
+    struct Options {
+        uint64_t period = 0;       //! Sample every N events or...
+        uint64_t frequency = 1000; //! ...N times per second when period is zero
+        bool callchain = false;    //! Also record the user callchain
+        bool branches = false;     //! Also record the last branch records (LBR)
+        bool kernel = false;       //! Also sample in kernel mode
+        uint32_t pages = 64;       //! Ring buffer data pages, power of two
+    };
+
+    //! One decoded PERF_RECORD_SAMPLE
+    struct Sample {
+        uint64_t ip;
+        uint64_t time;
+        uint32_t pid;
+        uint32_t tid;
+        uint32_t chain;  //! Offset of the callchain in Table::callchains
+        uint32_t depth;  //! Number of entries in the callchain
+        uint32_t stack;  //! Offset of the branch stack in Table::branches
+        uint32_t numbranches;  //! Number of entries in the branch stack
+    };
+
+    //! One taken branch from the LBR, the most recent comes first
+    struct Branch {
+        uint64_t from;
+        uint64_t to;
+        uint16_t cycles;    //! Cycles since the previous taken branch, 0 if unknown
+        bool mispredicted;  //! The target was mispredicted
+    };
+
+    //! All samples collected for one section
+    struct Table {
+        std::vector<Sample> samples;
+        std::vector<uint64_t> callchains;
+        std::vector<Branch> branches;
+        uint64_t lost = 0;  //! Samples dropped by the kernel on overflow
+    };
+    using SampleMap = std::map<std::string, Table>;
+
+    PerfSampler();
+    ~PerfSampler();
+    bool init(const std::string &event);
+    bool init(const std::string &event, const Options &options);
+    void close();
+
+    //! Discards anything pending and enables sampling
+    bool start();
+
+    //! Disables sampling and stores the pending samples under the given name
+    bool stop(const char *name);
+
+    //! Stores the pending samples under the given name without stopping.
+    //! Call it periodically on long sections so the buffer does not overflow.
+    size_t poll(const char *name);
+
+    const SampleMap &getSamples() const;
+
+    //! Prints the most sampled instruction pointers of a section
+    void print(const std::string &name, std::ostream &out, size_t top = 10) const;
+
+private:
+    size_t drain(Table *table);
+    int _fd;
+    perf_event_mmap_page *_page;
+    size_t _mapsize;
+    Options _options;
+    std::vector<uint8_t> _record;  //! Scratch for records that wrap around
+    SampleMap _samples;
+};
@@ -1,52 +1,61 @@
 #include "PerfUtils.h"
 #include <unordered_map>
+#include <cerrno>
 #include <cstring>
 #include <string>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <dlfcn.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
 
 bool initialize_libpfm() {
-    static bool _initialized = false;
-    if (_initialized) return true;
+    // Thread-safe, runs once per process
+    static bool _initialized = []() {
 #ifdef HAVE_LIBPFM
-    int ret = pfm_initialize();
-    if (ret != PFM_SUCCESS) {
-        fprintf(stderr, "Cannot initialize library: %s", pfm_strerror(ret));
-        return false;
-    }
+        int ret = pfm_initialize();
+        if (ret != PFM_SUCCESS) {
+            fprintf(stderr, "Cannot initialize library: %s", pfm_strerror(ret));
+            return false;
+        }
 #endif
-    _initialized = true;
-    return true;
+        return true;
+    }();
+    return _initialized;
 }
 
 #ifdef HAVE_LIBPFM
-bool translate(const char *events[], perf_event_attr_t *evds, size_t size) {
-    for (size_t j = 0; j < size; ++j) {
-        perf_event_attr_t &attr(evds[j]);
-        // memset(&attr, 0, sizeof(attr));
-        //  char *fstr = nullptr;
-        pfm_perf_encode_arg_t arg;
-        memset(&arg, 0, sizeof(arg));
-        arg.attr = &attr;
-        // arg.fstr = &fstr;
-        int ret = pfm_get_os_event_encoding(events[j], PFM_PLM0 | PFM_PLM3,
-                                            PFM_OS_PERF_EVENT_EXT, &arg);
-        if (ret != PFM_SUCCESS) {
-            std::cerr << "PerfGroup: could not translate event [" << events[j] << "] "
-                      << pfm_strerror(ret) << "\n";
-            return false;
-        }
-        // std::cerr << "Event:" << events[j] << " name: [" << fstr << "] type:" <<
-        // attr.type << " size:" << attr.size << " config:" << attr.config << "\n";
-        //::free(fstr);
+static bool encode(const char *event, perf_event_attr_t &attr) {
+    if (!initialize_libpfm()) return false;
+    memset(&attr, 0, sizeof(attr));
+    //  char *fstr = nullptr;
+    pfm_perf_encode_arg_t arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.attr = &attr;
+    arg.size = sizeof(arg);
+    // arg.fstr = &fstr;
+    int ret =
+        pfm_get_os_event_encoding(event, PFM_PLM0 | PFM_PLM3, PFM_OS_PERF_EVENT_EXT, &arg);
+    if (ret != PFM_SUCCESS) {
+        std::cerr << "PerfGroup: could not translate event [" << event << "] "
+                  << pfm_strerror(ret) << "\n";
+        return false;
     }
+    // std::cerr << "Event:" << event << " name: [" << fstr << "] type:" <<
+    // attr.type << " size:" << attr.size << " config:" << attr.config << "\n";
+    //::free(fstr);
     return true;
 }
 #else
-bool translate(const char *events[], perf_event_attr *evds, size_t size) {
+static bool encode(const char *event, perf_event_attr &pe) {
     struct TypeConfig {
         int type;
         unsigned long long config;
     };
-    std::unordered_map<std::string, TypeConfig> configmap = {
+    static const std::unordered_map<std::string, TypeConfig> configmap = {
         {"cycles", {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES}},
         {"instructions", {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS}},
         {"cache-misses", {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_MISSES}},
@@ -56,20 +65,221 @@ bool translate(const char *events[], perf_event_attr *evds, size_t size) {
         {"frontend-stall-cycles",
          {PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND}},
         {"pagefaults", {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}},
+        {"cpu-clock", {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK}},
+        {"task-clock", {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK}},
         {"context-switches", {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES}},
         {"cpu-migrations", {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS}},
         {"pagefaults-minor", {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN}},
         {"pagefaults-major", {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ}},
         {"alignment-faults", {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_ALIGNMENT_FAULTS}}};
+    memset(&pe, 0, sizeof(pe));
+    auto it = configmap.find(event);
+    if (it != configmap.end()) {
+        pe.type = it->second.type;
+        pe.config = it->second.config;
+    }
+    return true;
+}
+#endif
+
+// Process-wide cache of the encodings, so each event name only goes through
+// libpfm once no matter how many groups are created
+static std::mutex cache_mutex;
+static std::unordered_map<std::string, perf_event_attr> cache;
+
+bool translate(const char *events[], perf_event_attr *evds, size_t size) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
     for (size_t j = 0; j < size; ++j) {
-        perf_event_attr &pe(evds[j]);
-        memset(&pe, 0, sizeof(pe));
-        auto it = configmap.find(events[j]);
-        if (it != configmap.end()) {
-            pe.type = it->second.type;
-            pe.config = it->second.config;
+        auto it = cache.find(events[j]);
+        if (it == cache.end()) {
+            perf_event_attr attr;
+            if (!encode(events[j], attr)) return false;
+            it = cache.emplace(events[j], attr).first;
         }
+        evds[j] = it->second;
     }
     return true;
 }
+
+// File layout: header, then per event the name length (u32), the name and
+// the raw perf_event_attr. The attr size guards against a different kernel ABI
+// and the checksum of everything after the header against a damaged file.
+struct EncodingFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t attrsize;
+    uint32_t count;
+    uint64_t checksum;
+};
+static const char encoding_magic[4] = {'T', 'P', 'E', 'C'};
+static const uint32_t encoding_version = 2;
+
+// FNV-1a, enough to catch truncated or damaged files
+static uint64_t encoding_checksum(const std::string &data) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char ch : data) {
+        hash ^= ch;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+bool save_event_encodings(const std::string &filename) {
+    std::string body;
+    EncodingFileHeader header;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        for (const auto &entry : cache) {
+            uint32_t length = entry.first.size();
+            body.append((const char *)&length, sizeof(length));
+            body.append(entry.first);
+            body.append((const char *)&entry.second, sizeof(perf_event_attr));
+        }
+        header.count = cache.size();
+    }
+    memcpy(header.magic, encoding_magic, sizeof(header.magic));
+    header.version = encoding_version;
+    header.attrsize = sizeof(perf_event_attr);
+    header.checksum = encoding_checksum(body);
+    std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+    if (!ofs) {
+        std::cerr << "save_event_encodings: cannot open [" << filename << "]\n";
+        return false;
+    }
+    ofs.write((const char *)&header, sizeof(header));
+    ofs.write(body.data(), body.size());
+    return bool(ofs);
+}
+
+bool load_event_encodings(const std::string &filename) {
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs) {
+        // No cache yet is the normal case on a first run
+        if (errno == ENOENT) return false;
+        std::cerr << "load_event_encodings: cannot open [" << filename
+                  << "]: " << strerror(errno) << "\n";
+        return false;
+    }
+    EncodingFileHeader header;
+    if (!ifs.read((char *)&header, sizeof(header)) ||
+        (memcmp(header.magic, encoding_magic, sizeof(header.magic)) != 0) ||
+        (header.version != encoding_version) ||
+        (header.attrsize != sizeof(perf_event_attr))) {
+        std::cerr << "load_event_encodings: [" << filename
+                  << "] is not a compatible encoding file\n";
+        return false;
+    }
+    std::string body((std::istreambuf_iterator<char>(ifs)),
+                     std::istreambuf_iterator<char>());
+    if (encoding_checksum(body) != header.checksum) {
+        std::cerr << "load_event_encodings: [" << filename
+                  << "] is truncated or corrupt\n";
+        return false;
+    }
+    // Nothing is applied unless the whole file parses
+    std::unordered_map<std::string, perf_event_attr> loaded;
+    std::size_t pos = 0;
+    for (uint32_t j = 0; j < header.count; ++j) {
+        uint32_t length = 0;
+        if (body.size() - pos < sizeof(length)) break;
+        memcpy(&length, &body[pos], sizeof(length));
+        pos += sizeof(length);
+        if ((length == 0) || (body.size() - pos < length + sizeof(perf_event_attr))) {
+            break;
+        }
+        std::string name(body, pos, length);
+        pos += length;
+        perf_event_attr attr;
+        memcpy(&attr, &body[pos], sizeof(attr));
+        pos += sizeof(attr);
+        loaded.emplace(std::move(name), attr);
+    }
+    if ((loaded.size() != header.count) || (pos != body.size())) {
+        std::cerr << "load_event_encodings: [" << filename << "] has "
+                  << loaded.size() << " valid entries out of " << header.count
+                  << ", ignored\n";
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    for (auto &entry : loaded) cache[entry.first] = entry.second;
+    return true;
+}
+
+static bool nmi_watchdog_enabled() {
+    std::ifstream ifs("/proc/sys/kernel/nmi_watchdog");
+    int value = 0;
+    if (ifs >> value) return value != 0;
+    return false;
+}
+
+PmuCapacity get_pmu_capacity() {
+    static PmuCapacity capacity = []() {
+        // Conservative defaults for unknown architectures
+        PmuCapacity cap{4, 0, nmi_watchdog_enabled()};
+        bool found = false;
+#ifdef HAVE_LIBPFM
+        if (initialize_libpfm()) {
+            // Hybrid machines have more than one core PMU, take the smallest
+            pfm_pmu_t pmu;
+            pfm_for_all_pmus(pmu) {
+                pfm_pmu_info_t info;
+                memset(&info, 0, sizeof(info));
+                info.size = sizeof(info);
+                if (pfm_get_pmu_info(pmu, &info) != PFM_SUCCESS) continue;
+                if (!info.is_present || (info.type != PFM_PMU_TYPE_CORE)) continue;
+                if (!found || (info.num_cntrs < cap.general))
+                    cap.general = info.num_cntrs;
+                if (!found || (info.num_fixed_cntrs < cap.fixed))
+                    cap.fixed = info.num_fixed_cntrs;
+                found = true;
+            }
+        }
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        unsigned eax, ebx, ecx, edx;
+        if (!found && __get_cpuid(0, &eax, &ebx, &ecx, &edx)) {
+            // The vendor string ("GenuineIntel"/"AuthenticAMD") is stored as ebx,edx,ecx
+            bool intel =
+                (ebx == 0x756e6547) && (edx == 0x49656e69) && (ecx == 0x6c65746e);
+            bool amd =
+                (ebx == 0x68747541) && (edx == 0x69746e65) && (ecx == 0x444d4163);
+            if (intel && (eax >= 0xA)) {
+                __cpuid_count(0xA, 0, eax, ebx, ecx, edx);
+                if ((eax & 0xFF) != 0) {
+                    cap.general = (eax >> 8) & 0xFF;
+                    cap.fixed = edx & 0x1F;
+                    found = true;
+                }
+            } else if (amd && __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx)) {
+                // AMD: PerfCtrExtCore gives 6 core counters instead of the legacy 4
+                cap.general = (ecx & (1U << 23)) ? 6 : 4;
+                cap.fixed = 0;
+                found = true;
+            }
+        }
 #endif
+        if (cap.watchdog && (cap.general > 1)) cap.general -= 1;
+        return cap;
+    }();
+    return capacity;
+}
+
+int fixed_counter_index(const perf_event_attr &attr) {
+    if (attr.type != PERF_TYPE_HARDWARE) return -1;
+    switch (attr.config) {
+        case PERF_COUNT_HW_INSTRUCTIONS: return 0;
+        case PERF_COUNT_HW_CPU_CYCLES: return 1;
+        case PERF_COUNT_HW_REF_CPU_CYCLES: return 2;
+        default: return -1;
+    }
+}
+
+std::string symbol_name(uint64_t address) {
+    Dl_info info;
+    if ((::dladdr((void *)address, &info) == 0) || (info.dli_sname == nullptr)) {
+        return "?";
+    }
+    char offset[32];
+    snprintf(offset, sizeof(offset), "+0x%lx", address - (uint64_t)info.dli_saddr);
+    return std::string(info.dli_sname) + offset;
+}
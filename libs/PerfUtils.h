@@ -4,6 +4,8 @@
 #include <linux/perf_event.h>
 #include <linux/hw_breakpoint.h>
 #include <unistd.h>
+#include <cstdint>
+#include <string>
 
 #ifdef HAVE_LIBPFM
 #include <perfmon/pfmlib_perf_event.h>
@@ -17,7 +19,111 @@ static int perf_event_open(struct perf_event_attr *hw_event_uptr, pid_t pid, int
 }
 #endif
 
+#if defined(__GNUC__) && defined(__x86_64__)
+//! Reads a hardware counter directly. Index is the zero-based PMC index.
+static inline uint64_t rdpmc(uint32_t index) {
+    return __builtin_ia32_rdpmc(index);
+}
+
+//! Reads the timestamp counter, the time base used by the mmap'd page
+static inline uint64_t rdtsc() {
+    return __builtin_ia32_rdtsc();
+}
+#else
+static inline uint64_t rdpmc(uint32_t index) {
+    return 0;
+}
+
+static inline uint64_t rdtsc() {
+    return 0;
+}
+#endif
+
+//! A counter value along with the time (ns) it was enabled and actually counting
+struct MappedCount {
+    uint64_t value;
+    uint64_t enabled;
+    uint64_t running;
+};
+
+/** Reads the current value of a counter through its mmap'd control page.
+ * This follows the seqlock protocol documented in linux/perf_event.h so it
+ * never enters the kernel. If the event is not currently scheduled on the PMU
+ * (index zero) the value saved by the kernel at the last switch is returned.
+ * The enabled/running times are brought up to date with the TSC when the
+ * kernel allows it, so they can be used to scale multiplexed counters.
+ */
+static inline MappedCount read_mapped_counter(const volatile perf_event_mmap_page *pc) {
+    uint32_t seq;
+    MappedCount res;
+    do {
+        seq = pc->lock;
+        asm volatile("" ::: "memory");
+        res.enabled = pc->time_enabled;
+        res.running = pc->time_running;
+        uint32_t index = pc->index;
+        if (pc->cap_user_time) {
+            uint64_t cyc = rdtsc();
+            uint16_t shift = pc->time_shift;
+            uint64_t mult = pc->time_mult;
+            uint64_t quot = cyc >> shift;
+            uint64_t rem = cyc & ((uint64_t(1) << shift) - 1);
+            uint64_t delta = pc->time_offset + quot * mult + ((rem * mult) >> shift);
+            res.enabled += delta;
+            if (index != 0) res.running += delta;
+        }
+        res.value = pc->offset;
+        if (pc->cap_user_rdpmc && (index != 0)) {
+            uint32_t width = pc->pmc_width;
+            int64_t pmc = rdpmc(index - 1);
+            pmc <<= 64 - width;
+            pmc >>= 64 - width;
+            res.value += pmc;
+        }
+        asm volatile("" ::: "memory");
+    } while (pc->lock != seq);
+    return res;
+}
+
 /** Initialize libpfm if available */
 bool initialize_libpfm();
 
-bool translate(const char *events[], perf_event_attr *evds, size_t size);
\ No newline at end of file
+/** Encodes the event names into perf_event_attr structures. Encodings are
+ * cached process-wide so libpfm only resolves each name once.
+ */
+bool translate(const char *events[], perf_event_attr *evds, size_t size);
+
+/** Writes all encodings resolved so far to a file. Loading it on a later run
+ * (same kernel and machine) skips libpfm entirely for those events.
+ */
+bool save_event_encodings(const std::string &filename);
+
+/** Pre-populates the encoding cache from a file written by
+ * save_event_encodings(). The file is checked as a whole first: a damaged,
+ * truncated or incompatible file is reported and leaves the cache untouched.
+ * Returns false, silently, when the file does not exist yet.
+ */
+bool load_event_encodings(const std::string &filename);
+
+//! Number of hardware counters available on the core PMU
+struct PmuCapacity {
+    int general;    //! General purpose counters
+    int fixed;      //! Fixed counters (cycles/instructions/ref-cycles on Intel)
+    bool watchdog;  //! The NMI watchdog is on and steals one counter
+};
+
+/** Discovers how many counters the core PMU has, through libpfm if available
+ * and CPUID otherwise. The general count is already reduced by the NMI watchdog.
+ */
+PmuCapacity get_pmu_capacity();
+
+/** Returns the Intel fixed counter index an event would land on or -1 if
+ * the event can only be counted on a general purpose counter.
+ */
+int fixed_counter_index(const perf_event_attr &attr);
+
+/** Returns "symbol+0xoffset" for a code address or "?" if it cannot be
+ * resolved. Only exported symbols resolve, link with -rdynamic for the best
+ * results.
+ */
+std::string symbol_name(uint64_t address);
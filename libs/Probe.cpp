@@ -0,0 +1,81 @@
+#include "Probe.h"
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Names are few and registered at static init, a mutex is plenty
+static std::mutex &registry_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::deque<std::string> &registry_names() {
+    static std::deque<std::string> names;
+    return names;
+}
+
+uint32_t probe_id(const char *name) {
+    static std::unordered_map<std::string, uint32_t> ids;
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    auto it = ids.find(name);
+    if (it != ids.end()) return it->second;
+    std::deque<std::string> &names(registry_names());
+    names.push_back(name);
+    return ids[name] = names.size() - 1;
+}
+
+const char *probe_name(uint32_t id) {
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    std::deque<std::string> &names(registry_names());
+    return id < names.size() ? names[id].c_str() : nullptr;
+}
+
+ProbeStack &ProbeStack::local() {
+    thread_local ProbeStack stack;
+    return stack;
+}
+
+std::size_t ProbeStack::find(const Snapshot *snap) const {
+    for (std::size_t j = depth; j > 0; --j) {
+        if (frames[j - 1].snap == snap) return j - 1;
+    }
+    return ProbeFrame::NOPARENT;
+}
+
+bool ProbeStack::ready(std::size_t size) const {
+    if (depth >= frames.size()) return false;
+    const ProbeFrame &frame(frames[depth]);
+    return (frame.entry.capacity() >= size) && (frame.children.capacity() >= size) &&
+           (frame.scratch.capacity() >= size);
+}
+
+void ProbeStack::reserve(std::size_t size) {
+    if (depth == frames.size()) frames.emplace_back();
+    ProbeFrame &frame(frames[depth]);
+    frame.entry.reserve(size);
+    frame.children.reserve(size);
+    frame.scratch.reserve(size);
+}
+
+void ProbeStack::pause() {
+    for (std::size_t j = 0; j < depth; ++j) {
+        ProbeFrame &frame(frames[j]);
+        if (find(frame.snap) != j) continue;
+        frame.snap->sample(frame.scratch.data());
+        for (std::size_t k = 0; k < frame.scratch.size(); ++k) {
+            frame.children[k] -= frame.scratch[k];
+        }
+    }
+}
+
+void ProbeStack::resume() {
+    for (std::size_t j = depth; j > 0; --j) {
+        ProbeFrame &frame(frames[j - 1]);
+        if (find(frame.snap) != j - 1) continue;
+        frame.snap->sample(frame.scratch.data());
+        for (std::size_t k = 0; k < frame.scratch.size(); ++k) {
+            frame.children[k] += frame.scratch[k];
+        }
+    }
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "Snapshot.h"
+
+//! Returns the process-wide id of a probe name, the same for equal names
+uint32_t probe_id(const char *name);
+
+//! Returns the name a probe id was registered with
+const char *probe_name(uint32_t id);
+
+//! Resolves a probe name type (see PROBE) to its id once, at static init
+template <class Name>
+struct ProbeId {
+    static const uint32_t value;
+};
+template <class Name>
+const uint32_t ProbeId<Name>::value = probe_id(Name::value());
+
+//! One open probe on the calling thread's stack
+struct ProbeFrame {
+    static constexpr std::size_t NOPARENT = ~std::size_t(0);
+    Snapshot *snap;
+    std::size_t parent;            //! Enclosing frame on the same snapshot
+    std::vector<double> entry;     //! Counter totals when the probe opened
+    std::vector<double> children;  //! Totals spent in nested probes
+    std::vector<double> scratch;
+};
+
+//! Probes currently open on this thread. Frames are reused, so after the
+//! first time a depth is reached opening a probe does not allocate.
+struct ProbeStack {
+    std::vector<ProbeFrame> frames;
+    std::size_t depth = 0;
+    static ProbeStack &local();
+
+    //! Nearest open frame measuring snap, NOPARENT if none
+    std::size_t find(const Snapshot *snap) const;
+    //! Whether the next frame can hold size counters without allocating
+    bool ready(std::size_t size) const;
+    //! Makes the next frame hold size counters
+    void reserve(std::size_t size);
+    /** Bracket work the open probes should not measure, such as first-use
+     * allocations. The counts in between are added to the children of the
+     * innermost open frame of each snapshot, so all of them leave it out.
+     */
+    void pause();
+    void resume();
+};
+
+/** Measures the enclosing scope into a Snapshot under the compile-time
+ * name `Name::value()`. Use the PROBE macro rather than naming it directly.
+ *
+ * The outermost probe of a snapshot on a thread starts and stops its
+ * counters. Probes nested inside it on the same snapshot, even with probes
+ * of other snapshots in between, read the running counters instead, and
+ * their totals are taken off the enclosing probe. Each probe records only
+ * the counts of its own region, excluding nested probes. Registering the
+ * event and growing the stack on first use are not measured.
+ */
+template <class Name>
+class ScopedProbe {
+public:
+    ScopedProbe(Snapshot &snap, uint64_t numitems = 1, uint64_t numiterations = 1)
+        : _snap(snap), _numitems(numitems), _numiterations(numiterations) {
+        ProbeStack &stack(ProbeStack::local());
+        std::size_t size = snap.getCounters().size();
+        _event = snap.findProbeEvent(ProbeId<Name>::value);
+        if ((_event == Snapshot::NOEVENT) || !stack.ready(size)) {
+            stack.pause();
+            _event = snap.probeEvent(ProbeId<Name>::value, Name::value());
+            stack.reserve(size);
+            stack.resume();
+        }
+        std::size_t parent = stack.find(&snap);
+        _depth = stack.depth++;
+        ProbeFrame &frame(stack.frames[_depth]);
+        frame.snap = &snap;
+        frame.parent = parent;
+        frame.entry.assign(size, 0);
+        frame.children.assign(size, 0);
+        frame.scratch.resize(size);
+        if (parent == ProbeFrame::NOPARENT) {
+            snap.start();
+        } else {
+            snap.sample(frame.entry.data());
+        }
+    }
+
+    ~ScopedProbe() {
+        ProbeStack &stack(ProbeStack::local());
+        ProbeFrame &frame(stack.frames[_depth]);
+        std::size_t size = frame.entry.size();
+        if (frame.parent == ProbeFrame::NOPARENT) {
+            _snap.stop(_event, _numitems, _numiterations, frame.children.data());
+        } else {
+            ProbeFrame &parent(stack.frames[frame.parent]);
+            std::vector<double> &now(frame.scratch);
+            _snap.sample(now.data());
+            for (std::size_t j = 0; j < size; ++j) {
+                double total = now[j] - frame.entry[j];
+                parent.children[j] += total;
+                now[j] = total - frame.children[j];
+            }
+            _snap.record(_event, _numitems, _numiterations, now.data());
+        }
+        stack.depth = _depth;
+    }
+
+    //! Sets the number of items processed, if only known at the end
+    void items(uint64_t numitems) {
+        _numitems = numitems;
+    }
+    //! Sets the number of iterations to average over
+    void iterations(uint64_t numiterations) {
+        _numiterations = numiterations;
+    }
+
+    ScopedProbe(const ScopedProbe &) = delete;
+    ScopedProbe &operator=(const ScopedProbe &) = delete;
+
+private:
+    Snapshot &_snap;
+    Snapshot::EventId _event;
+    std::size_t _depth;
+    uint64_t _numitems;
+    uint64_t _numiterations;
+};
+
+#define TINYPERF_CONCAT2(a, b) a##b
+#define TINYPERF_CONCAT(a, b) TINYPERF_CONCAT2(a, b)
+
+/** Measures the rest of the enclosing scope into `snap` as event `name`,
+ * which must be a string literal. Optional arguments are the number of
+ * items and of iterations, see Snapshot::stop().
+ *   void work() { PROBE(snap, "work"); ... }
+ */
+#define PROBE(snap, name, ...)                                   \
+    struct TINYPERF_CONCAT(ProbeName_, __LINE__) {               \
+        static constexpr const char *value() {                   \
+            return name;                                         \
+        }                                                        \
+    };                                                           \
+    ScopedProbe<TINYPERF_CONCAT(ProbeName_, __LINE__)>           \
+        TINYPERF_CONCAT(probe_, __LINE__)(snap, ##__VA_ARGS__)
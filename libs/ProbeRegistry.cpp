@@ -0,0 +1,138 @@
+#include "ProbeRegistry.h"
+#include <chrono>
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Marks this thread's probes as orphaned when the thread exits so the
+// publisher collects what is left and frees them
+struct ThreadProbeOwner {
+    ~ThreadProbeOwner() {
+        ProbeRegistry::instance().detach(thread_probes);
+    }
+};
+
+ProbeRegistry::ProbeRegistry() {
+    // Without membarrier every record pays a full fence instead
+    long commands = ::syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+    if ((commands > 0) && (commands & MEMBARRIER_CMD_PRIVATE_EXPEDITED)) {
+        int command = MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED;
+        probe_membarrier = (::syscall(__NR_membarrier, command, 0, 0) == 0);
+    }
+}
+
+// Full barrier on every running thread of the process, pairs with probe_fence()
+static void process_barrier() {
+    if (probe_membarrier) {
+        ::syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+    } else {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+ProbeRegistry &ProbeRegistry::instance() {
+    // Never destroyed, threads may still record during static destruction
+    static ProbeRegistry *registry = new ProbeRegistry();
+    return *registry;
+}
+
+bool ProbeRegistry::attach(uint32_t probe) {
+    ThreadProbeTable &table(thread_probes);
+    // The owner is gone, a new table would never be freed
+    if (table.detached) return false;
+    thread_local ThreadProbeOwner owner;
+    (void)owner;
+    if (probe >= table.size) {
+        uint32_t size = probe + 1;
+        ThreadProbe **slots = new ThreadProbe *[size];
+        for (uint32_t j = 0; j < size; ++j) {
+            slots[j] = (j < table.size) ? table.slots[j] : nullptr;
+        }
+        delete[] table.slots;
+        table.slots = slots;
+        table.size = size;
+    }
+    ThreadProbe *tp = new ThreadProbe();
+    table.slots[probe] = tp;
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.push_back({probe, tp});
+    return true;
+}
+
+void ProbeRegistry::detach(ThreadProbeTable &table) {
+    for (uint32_t j = 0; j < table.size; ++j) {
+        if (table.slots[j] != nullptr) {
+            table.slots[j]->exited.store(true, std::memory_order_release);
+        }
+    }
+    delete[] table.slots;
+    table.slots = nullptr;
+    table.size = 0;
+    table.detached = true;
+}
+
+void ProbeRegistry::publish() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (ThreadProbe::Histogram &hist : _merged) hist.clear();
+    for (const Entry &entry : _entries) {
+        entry.tp->claimed.store(true, std::memory_order_relaxed);
+    }
+    process_barrier();
+    std::vector<Entry> alive;
+    alive.reserve(_entries.size());
+    for (const Entry &entry : _entries) {
+        ThreadProbe *tp = entry.tp;
+        if (entry.probe >= _merged.size()) _merged.resize(entry.probe + 1);
+        ThreadProbe::Histogram &merged(_merged[entry.probe]);
+        if (tp->exited.load(std::memory_order_acquire)) {
+            // Nobody writes anymore, take what is left
+            merged.merge(*tp->active);
+            delete tp;
+            continue;
+        }
+        // A busy owner is in the middle of an add, its values wait for the
+        // next round. Otherwise it now waits for the claim to be lifted.
+        if (!tp->busy.load(std::memory_order_acquire)) std::swap(tp->active, tp->spare);
+        tp->claimed.store(false, std::memory_order_release);
+        merged.merge(*tp->spare);
+        tp->spare->clear();
+        alive.push_back(entry);
+    }
+    _entries.swap(alive);
+
+    _latest.clear();
+    for (uint32_t probe = 0; probe < _merged.size(); ++probe) {
+        const ThreadProbe::Histogram &hist(_merged[probe]);
+        if (hist.count() == 0) continue;
+        _latest.push_back(Stats{probe_name(probe), hist.count(), hist.average(),
+                                hist.percentile(50), hist.percentile(90),
+                                hist.percentile(99), hist.percentile(99.9)});
+    }
+}
+
+std::vector<ProbeRegistry::Stats> ProbeRegistry::latest() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _latest;
+}
+
+bool ProbeRegistry::startPublisher(double seconds, Callback callback) {
+    if (_running.exchange(true)) return false;
+    _publisher = std::thread([this, seconds, callback]() {
+        using Clock = std::chrono::steady_clock;
+        auto period = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(seconds));
+        auto next = Clock::now();
+        while (_running.load(std::memory_order_relaxed)) {
+            next += period;
+            std::this_thread::sleep_until(next);
+            publish();
+            if (callback) callback(latest());
+        }
+    });
+    return true;
+}
+
+void ProbeRegistry::stopPublisher() {
+    if (!_running.exchange(false)) return;
+    if (_publisher.joinable()) _publisher.join();
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MicroStats.h"
+#include "Probe.h"
+#include "TimingUtils.h"
+
+//! Whether the publisher can force a barrier on every thread with
+//! membarrier(2), see ProbeRegistry::publish(). Set once by the registry
+//! before any thread records.
+inline bool probe_membarrier = false;
+
+//! Owner side of the barrier pairing with the publisher's
+inline void probe_fence() {
+    if (probe_membarrier) {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    } else {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+/** Latency histogram of one probe owned by one thread.
+ * The owner adds to `active` between setting and clearing `busy`, and
+ * holds off while `claimed` is set. To collect, the publisher sets
+ * `claimed` and then forces a barrier on every thread, after which either
+ * the owner sees the claim or the publisher sees it busy. Unless busy, the
+ * publisher swaps `active` with the empty `spare` and merges the old one.
+ * The owner only does plain loads and stores, and idle threads are
+ * collected as well.
+ */
+struct ThreadProbe {
+    using Histogram = MicroStats<2>;
+    Histogram *active;
+    Histogram *spare;  //! Publisher only
+    std::atomic<bool> busy{false};
+    std::atomic<bool> claimed{false};
+    std::atomic<bool> exited{false};  //! Owner is gone, `active` is free to read
+    Histogram buffers[2];
+
+    ThreadProbe() : active(&buffers[0]), spare(&buffers[1]) {
+    }
+    //! Returns the histogram to add to, owner only
+    Histogram *enter() {
+        busy.store(true, std::memory_order_relaxed);
+        probe_fence();
+        while (claimed.load(std::memory_order_acquire)) {
+            // The publisher is swapping buffers, which takes a few stores
+            busy.store(false, std::memory_order_release);
+            while (claimed.load(std::memory_order_acquire)) std::this_thread::yield();
+            busy.store(true, std::memory_order_relaxed);
+            probe_fence();
+        }
+        return active;
+    }
+    void leave() {
+        busy.store(false, std::memory_order_release);
+    }
+};
+
+//! Per-thread table of probes, indexed by probe id (see probe_id())
+struct ThreadProbeTable {
+    ThreadProbe **slots;
+    uint32_t size;
+    bool detached;  //! The thread is exiting and its probes were handed over
+};
+inline thread_local ThreadProbeTable thread_probes{nullptr, 0, false};
+
+/** Process-wide registry of always-on latency probes.
+ * Probes record tic() deltas into per-thread MicroStats with no locks and
+ * no syscalls. A background thread periodically collects every thread's
+ * histograms, idle or not, merges them per probe and publishes percentiles
+ * for the interval.
+ */
+class ProbeRegistry {
+public:
+    //! Percentiles of one probe over the last published interval, in ticks
+    struct Stats {
+        std::string name;
+        uint64_t count;
+        double average;
+        double p50;
+        double p90;
+        double p99;
+        double p999;
+    };
+    using Callback = std::function<void(const std::vector<Stats> &)>;
+
+    static ProbeRegistry &instance();
+
+    //! Records one measurement, in ticks, for the probe. Dropped when made
+    //! from a thread_local destructor that runs after the thread detached.
+    static void record(uint32_t probe, uint64_t ticks) {
+        ThreadProbeTable &table(thread_probes);
+        if ((probe >= table.size) || (table.slots[probe] == nullptr)) {
+            if (!instance().attach(probe)) return;
+        }
+        ThreadProbe *tp = table.slots[probe];
+        tp->enter()->add(ticks);
+        tp->leave();
+    }
+
+    //! Collects and publishes once, from the calling thread
+    void publish();
+
+    //! Publishes every `seconds` from a background thread, calling `callback`
+    //! (if set) with the results on that thread
+    bool startPublisher(double seconds, Callback callback = nullptr);
+    void stopPublisher();
+
+    //! Results of the last publish()
+    std::vector<Stats> latest() const;
+
+private:
+    ProbeRegistry();
+    bool attach(uint32_t probe);
+    void detach(ThreadProbeTable &table);
+    friend struct ThreadProbeOwner;
+
+    struct Entry {
+        uint32_t probe;
+        ThreadProbe *tp;
+    };
+    mutable std::mutex _mutex;
+    std::vector<Entry> _entries;
+    std::vector<ThreadProbe::Histogram> _merged;  //! Per probe, publisher only
+    std::vector<Stats> _latest;
+    std::thread _publisher;
+    std::atomic<bool> _running{false};
+};
+
+//! Times the enclosing scope into the registry, see LATENCY_PROBE
+template <class Name>
+class LatencyProbe {
+public:
+    LatencyProbe() : _start(tic()) {
+    }
+    ~LatencyProbe() {
+        ProbeRegistry::record(ProbeId<Name>::value, tic() - _start);
+    }
+    LatencyProbe(const LatencyProbe &) = delete;
+    LatencyProbe &operator=(const LatencyProbe &) = delete;
+
+private:
+    uint64_t _start;
+};
+
+/** Times the rest of the enclosing scope into the always-on registry.
+ *   void onPacket(...) { LATENCY_PROBE("md.packet"); ... }
+ */
+#define LATENCY_PROBE(name)                                    \
+    struct TINYPERF_CONCAT(LatencyName_, __LINE__) {           \
+        static constexpr const char *value() {                 \
+            return name;                                       \
+        }                                                      \
+    };                                                         \
+    LatencyProbe<TINYPERF_CONCAT(LatencyName_, __LINE__)>      \
+        TINYPERF_CONCAT(latency_, __LINE__)
@@ -92,8 +92,8 @@ bool RegResults::solve() {
     return true;
 }
 
-void summary(const Snapshot::EventMap &events, const std::string &header,
-             const std::string &dependent_name, std::ostream &out) {
+std::vector<Model> fit(const Snapshot::EventMap &events,
+                       const std::string &dependent_name, std::ostream &out) {
     struct Option {
         std::string name;
         std::function<double(size_t)> convert;
@@ -104,6 +104,8 @@ void summary(const Snapshot::EventMap &events, const std::string &header,
         {"N2", [](size_t n) { return n * n; }},
         {"NlogN", [](size_t n) { return n * log(n) / log(10); }}};
 
+    std::vector<Model> models;
+    bool reported = false;
     for (const auto &ism : events) {
         std::string event_name = ism.first;
         const Snapshot::Event &event(ism.second);
@@ -123,9 +125,13 @@ void summary(const Snapshot::EventMap &events, const std::string &header,
             }
         }
         if (!found_index) {
-            out << "Could not find dependent variable [" << dependent_name
-                << "] in the metrics list\n";
-            return;
+            // Once for all the events lacking it
+            if (!reported) {
+                out << "Could not find dependent variable [" << dependent_name
+                    << "] in the metrics list\n";
+                reported = true;
+            }
+            continue;
         }
 
         // Build the stats matrix
@@ -162,29 +168,61 @@ void summary(const Snapshot::EventMap &events, const std::string &header,
                 found = true;
             }
         }
+        if (not found) continue;
+
+        Model model{event.name,     bestname,    bestreg.rsq, bestreg.fpval,
+                    bestreg.loglik, bestreg.aic, bestreg.bic, {}};
+        for (size_t col = 0; col <= numvars; ++col) {
+            std::string colname;
+            if (col == dependent_index)
+                colname = bestname;
+            else if (col == numvars)
+                colname = "Constant";
+            else
+                colname = event.metrics[col].name;
+            model.coefficients.push_back({colname, bestreg.sol(col), bestreg.pval(col)});
+        }
+        models.push_back(std::move(model));
+    }
+    return models;
+}
 
-        if (not found) {
-            out << "    Model did not converge or not enough points\n";
-        } else {
-            out << "\n========== Best Model:\n" << event.name << ", ";
-            char line[256];
+void summary(const Snapshot::EventMap &events, const std::string &header,
+             const std::string &dependent_name, std::ostream &out) {
+    std::vector<Model> models = fit(events, dependent_name, out);
+    size_t next = 0;
+    char line[256];
+    for (const auto &ism : events) {
+        const Snapshot::Event &event(ism.second);
+        if ((next < models.size()) && (models[next].event == event.name)) {
+            const Model &model(models[next++]);
+            out << "\n========== Best Model:\n" << model.event << ", ";
             snprintf(line, sizeof(line), " Rsq:%5.2f F:%f LL:%f aic:%f bic:%f \n",
-                     bestreg.rsq, bestreg.fpval, bestreg.loglik, bestreg.aic,
-                     bestreg.bic);
+                     model.rsq, model.fpval, model.loglik, model.aic, model.bic);
             out << header << "," << line;
-            for (size_t col = 0; col <= numvars; ++col) {
-                std::string colname;
-                if (col == dependent_index)
-                    colname = bestname;
-                else if (col == numvars)
-                    colname = "Constant";
-                else
-                    colname = event.metrics[col].name;
+            for (const Coefficient &coef : model.coefficients) {
                 snprintf(line, sizeof(line), "   %-15s  p:%7.5f coef:%g\n",
-                         colname.c_str(), bestreg.pval(col), bestreg.sol(col));
+                         coef.name.c_str(), coef.pval, coef.coef);
                 out << line;
             }
-            out << "\n";
+        } else {
+            out << "\n========== " << event.name << ":\n";
+            // fit() already reported a missing dependent variable
+            bool hasdependent = false;
+            for (const Snapshot::Metric &metric : event.metrics) {
+                hasdependent = hasdependent || (metric.name == dependent_name);
+            }
+            if (hasdependent) out << "    Model did not converge or not enough points\n";
+        }
+        // The distributions do not depend on the fit
+        for (size_t j = 0; j < event.distributions.size(); ++j) {
+            const Snapshot::Distribution &dist(event.distributions[j]);
+            if (dist.count() == 0) continue;
+            snprintf(line, sizeof(line), "   %-15s  p50:%g p90:%g p99:%g\n",
+                     event.metrics[j].name.c_str(), dist.percentile(50),
+                     dist.percentile(90), dist.percentile(99));
+            out << line;
         }
+        out << "\n";
     }
 }
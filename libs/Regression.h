@@ -2,6 +2,33 @@
 
 #include "Snapshot.h"
 #include <iostream>
+#include <string>
+#include <vector>
+
+//! One term of a fitted model
+struct Coefficient {
+    std::string name;
+    double coef;
+    double pval;
+};
+
+//! Best fitting complexity model (N, logN, N2, NlogN) of one event
+struct Model {
+    std::string event;
+    std::string complexity;
+    double rsq;
+    double fpval;
+    double loglik;
+    double aic;
+    double bic;
+    std::vector<Coefficient> coefficients;
+};
+
+//! Fits every event against the flavors of N and keeps the lowest AIC model.
+//! Events with too few points or no convergence are left out.
+std::vector<Model> fit(const Snapshot::EventMap &samples,
+                       const std::string &dependent_name = "cycles",
+                       std::ostream &out = std::cout);
 
 void summary(const Snapshot::EventMap &samples, const std::string &header,
              const std::string &dependent_name = "cycles", std::ostream &out = std::cout);
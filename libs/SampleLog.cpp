@@ -0,0 +1,205 @@
+#include "SampleLog.h"
+#include "TimingUtils.h"
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char log_magic[4] = {'T', 'P', 'S', 'L'};
+
+SampleLog::SampleLog()
+    : _fd(-1), _ptr(nullptr), _mapsize(0), _used(0), _chunksize(0), _recordsize(0),
+      _numcounters(0) {
+}
+
+SampleLog::~SampleLog() {
+    close();
+}
+
+bool SampleLog::isOpen() const {
+    return _fd >= 0;
+}
+
+bool SampleLog::open(const std::string &filename,
+                     const std::vector<std::string> &counters, std::size_t chunksize) {
+    close();
+    int fd = ::open(filename.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "SampleLog: cannot open [" << filename << "]: " << strerror(errno)
+                  << '\n';
+        return false;
+    }
+    const std::size_t pagesize = ::getpagesize();
+    _fd = fd;
+    _chunksize = ((chunksize + pagesize - 1) / pagesize) * pagesize;
+    _numcounters = counters.size();
+    _recordsize = sizeof(Record) + _numcounters * sizeof(double);
+
+    Header header;
+    memcpy(header.magic, log_magic, sizeof(header.magic));
+    header.version = 1;
+    header.numcounters = _numcounters;
+    header.recordsize = _recordsize;
+    header.headersize = sizeof(Header) + _numcounters * NAMESIZE;
+    char *ptr = static_cast<char *>(reserve(header.headersize));
+    if (ptr == nullptr) {
+        close();
+        return false;
+    }
+    memcpy(ptr, &header, sizeof(header));
+    for (std::size_t j = 0; j < _numcounters; ++j) {
+        strncpy(ptr + sizeof(Header) + j * NAMESIZE, counters[j].c_str(), NAMESIZE - 1);
+    }
+    return true;
+}
+
+void SampleLog::close() {
+    if (_ptr != nullptr) {
+        ::munmap(_ptr, _mapsize);
+        _ptr = nullptr;
+    }
+    if (_fd >= 0) {
+        if (::ftruncate(_fd, _used) != 0) {
+            std::cerr << "SampleLog: could not trim file: " << strerror(errno) << '\n';
+        }
+        ::close(_fd);
+        _fd = -1;
+    }
+    _mapsize = 0;
+    _used = 0;
+}
+
+// Returns room for size bytes at the end of the log, extending the file and
+// the mapping by whole chunks when needed. Fresh pages read as zeros.
+void *SampleLog::reserve(std::size_t size) {
+    if (_fd < 0) return nullptr;
+    if (_used + size > _mapsize) {
+        std::size_t newsize = _mapsize + _chunksize;
+        while (newsize < _used + size) newsize += _chunksize;
+        if (::ftruncate(_fd, newsize) != 0) {
+            std::cerr << "SampleLog: could not extend file: " << strerror(errno) << '\n';
+            return nullptr;
+        }
+        void *ptr;
+        if (_ptr == nullptr) {
+            ptr = ::mmap(nullptr, newsize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        } else {
+            ptr = ::mremap(_ptr, _mapsize, newsize, MREMAP_MAYMOVE);
+        }
+        if (ptr == MAP_FAILED) {
+            std::cerr << "SampleLog: cannot map file: " << strerror(errno) << '\n';
+            return nullptr;
+        }
+        _ptr = static_cast<char *>(ptr);
+        _mapsize = newsize;
+    }
+    void *ptr = _ptr + _used;
+    _used += size;
+    return ptr;
+}
+
+bool SampleLog::define(uint32_t event, const std::string &name) {
+    std::size_t numrecords = 1 + (name.size() + _recordsize - 1) / _recordsize;
+    char *ptr = static_cast<char *>(reserve(numrecords * _recordsize));
+    if (ptr == nullptr) return false;
+    memcpy(ptr + sizeof(Record), name.data(), name.size());
+    Record *record = reinterpret_cast<Record *>(ptr);
+    record->event = event;
+    record->numitems = 0;
+    record->numiterations = name.size();
+    record->timestamp = utcnow();
+    // Kind goes last so a torn record reads as the end of the log
+    __atomic_store_n(&record->kind, Name, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool SampleLog::append(uint32_t event, uint64_t numitems, uint64_t numiterations,
+                       const double *values) {
+    char *ptr = static_cast<char *>(reserve(_recordsize));
+    if (ptr == nullptr) return false;
+    memcpy(ptr + sizeof(Record), values, _numcounters * sizeof(double));
+    Record *record = reinterpret_cast<Record *>(ptr);
+    record->event = event;
+    record->numitems = numitems;
+    record->numiterations = numiterations;
+    record->timestamp = utcnow();
+    __atomic_store_n(&record->kind, Sample, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool SampleLog::read(const std::string &filename, Snapshot::EventMap &events) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "SampleLog: cannot open [" << filename << "]: " << strerror(errno)
+                  << '\n';
+        return false;
+    }
+    struct stat st;
+    if ((::fstat(fd, &st) != 0) || (std::size_t(st.st_size) < sizeof(Header))) {
+        ::close(fd);
+        return false;
+    }
+    std::size_t size = st.st_size;
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return false;
+    const char *ptr = static_cast<const char *>(map);
+
+    Header header;
+    memcpy(&header, ptr, sizeof(header));
+    if ((memcmp(header.magic, log_magic, sizeof(header.magic)) != 0) ||
+        (header.version != 1) ||
+        (header.recordsize != sizeof(Record) + header.numcounters * sizeof(double)) ||
+        (header.headersize > size)) {
+        std::cerr << "SampleLog: [" << filename << "] is not a sample log\n";
+        ::munmap(map, size);
+        return false;
+    }
+    std::vector<std::string> counters(header.numcounters);
+    for (std::size_t j = 0; j < header.numcounters; ++j) {
+        const char *name = ptr + sizeof(Header) + j * NAMESIZE;
+        counters[j].assign(name, strnlen(name, NAMESIZE));
+    }
+
+    std::vector<Snapshot::Event *> byid;
+    std::vector<double> values(header.numcounters);
+    std::size_t offset = header.headersize;
+    while (offset + header.recordsize <= size) {
+        Record record;
+        memcpy(&record, ptr + offset, sizeof(record));
+        const char *payload = ptr + offset + sizeof(Record);
+        offset += header.recordsize;
+        if (record.kind == Name) {
+            std::size_t length = record.numiterations;
+            std::size_t extra = (length + header.recordsize - 1) / header.recordsize;
+            if (offset + extra * header.recordsize > size) break;
+            offset += extra * header.recordsize;
+            std::string name(payload, length);
+            Snapshot::Event &event(events[name]);
+            if (event.metrics.empty()) {
+                event.name = name;
+                event.metrics.resize(counters.size());
+                for (size_t j = 0; j < counters.size(); ++j) {
+                    event.metrics[j].name = counters[j];
+                }
+            }
+            if (byid.size() <= record.event) byid.resize(record.event + 1, nullptr);
+            byid[record.event] = &event;
+        } else if (record.kind == Sample) {
+            if (record.event >= byid.size()) continue;
+            if ((byid[record.event] == nullptr) || (record.numiterations == 0)) continue;
+            Snapshot::Event &event(*byid[record.event]);
+            memcpy(values.data(), payload, values.size() * sizeof(double));
+            event.N.push_back(record.numitems);
+            for (size_t j = 0; j < values.size(); ++j) {
+                event.metrics[j].values.push_back(values[j] / record.numiterations);
+            }
+        } else {
+            break;
+        }
+    }
+    ::munmap(map, size);
+    return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Snapshot.h"
+
+/** Append-only binary log of Snapshot samples, memory mapped so appending a
+ * record is a plain memcpy. The file starts with a header naming the
+ * counters and continues with fixed-size records, either a sample or the
+ * definition of an event name. The file grows in chunks of zeroed pages, so
+ * after a crash the log simply ends at the first all-zero record.
+ * Attach it with Snapshot::setLog() and rebuild the EventMap later with
+ * SampleLog::read().
+ */
+class SampleLog {
+public:
+    SampleLog();
+    ~SampleLog();
+
+    //! Creates (truncates) the log for the given counter names
+    bool open(const std::string &filename, const std::vector<std::string> &counters,
+              std::size_t chunksize = 16 << 20);
+    //! Trims the file to the records written and closes it
+    void close();
+    bool isOpen() const;
+
+    //! Records the name of an event id. Needs to happen before its samples.
+    bool define(uint32_t event, const std::string &name);
+    //! Appends one sample. values are the counter totals for all iterations.
+    bool append(uint32_t event, uint64_t numitems, uint64_t numiterations,
+                const double *values);
+
+    //! Rebuilds the per-iteration EventMap, as Snapshot would have kept it
+    static bool read(const std::string &filename, Snapshot::EventMap &events);
+
+private:
+    enum Kind : uint32_t { End = 0, Sample = 1, Name = 2 };
+    //! Common prefix of every record. Sample records follow it with one
+    //! double per counter. Name records follow it with the name bytes,
+    //! spilling into as many extra records as needed.
+    struct Record {
+        uint32_t kind;
+        uint32_t event;
+        uint64_t numitems;
+        uint64_t numiterations;  //! Name records: length of the name
+        int64_t timestamp;       //! UTC nanoseconds
+    };
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t numcounters;
+        uint32_t recordsize;
+        uint64_t headersize;  //! Offset of the first record
+    };
+    static constexpr std::size_t NAMESIZE = 64;
+    void *reserve(std::size_t size);
+
+    int _fd;
+    char *_ptr;
+    std::size_t _mapsize;
+    std::size_t _used;
+    std::size_t _chunksize;
+    std::size_t _recordsize;
+    std::size_t _numcounters;
+};
@@ -1,4 +1,6 @@
 #include "Snapshot.h"
+#include "PerfSampler.h"
+#include "SampleLog.h"
 #include <iostream>
 #include <cmath>
 
@@ -6,6 +8,15 @@ Snapshot::Snapshot(const std::vector<std::string> &pmc) {
     if (!counters.init(pmc)) {
         std::cerr << "Unable to initialize performance counters group" << '\n';
     }
+    totals.resize(counters.size());
+}
+
+Snapshot::Snapshot(const std::vector<std::string> &pmc,
+                   const PerfGroup::Options &options) {
+    if (!counters.init(pmc, options)) {
+        std::cerr << "Unable to initialize performance counters group" << '\n';
+    }
+    totals.resize(counters.size());
 }
 
 Snapshot::Snapshot() {
@@ -14,45 +25,241 @@ Snapshot::Snapshot() {
     if (!counters.init(counter_names)) {
         std::cerr << "Unable to initialize performance counters group" << '\n';
     }
+    totals.resize(counters.size());
 }
 
 Snapshot::~Snapshot() {
 }
 
 void Snapshot::start() {
+    if (sampler != nullptr) sampler->start();
     counters.start();
 }
 
 void Snapshot::stop(const char *event_name, uint64_t numitems, uint64_t numiterations) {
+    // Stop first so the name lookup, and the allocations of a new event, are
+    // not measured
+    counters.stop();
+    finish(registerEvent(event_name), numitems, numiterations, nullptr);
+}
+
+Snapshot::EventId Snapshot::registerEvent(const char *event_name, std::size_t capacity) {
+    for (std::size_t j = 0; j < records.size(); ++j) {
+        if (records[j].name == event_name) return j;
+    }
+    Record record;
+    record.name = event_name;
+    record.N.resize(capacity);
+    record.columns.resize(counters.size());
+    for (std::vector<double> &column : record.columns) {
+        column.resize(capacity);
+    }
+    if (distributions) record.distributions.resize(counters.size());
+    records.push_back(std::move(record));
+    if (log != nullptr) log->define(records.size() - 1, event_name);
+    return records.size() - 1;
+}
+
+void Snapshot::stop(EventId id, uint64_t numitems, uint64_t numiterations) {
+    stop(id, numitems, numiterations, nullptr);
+}
+
+void Snapshot::stop(EventId id, uint64_t numitems, uint64_t numiterations,
+                    const double *exclude) {
     counters.stop();
+    finish(id, numitems, numiterations, exclude);
+}
+
+void Snapshot::finish(EventId id, uint64_t numitems, uint64_t numiterations,
+                      const double *exclude) {
+    // Calibration runs, see calibrate()
+    if (id == NOEVENT) return;
+    if (sampler != nullptr) sampler->stop(records[id].name.c_str());
     last_iterations = numiterations;
-    if (numiterations > 0) {
-        Event &event(events[event_name]);
+    for (size_t j = 0; j < totals.size(); ++j) {
+        totals[j] = count(j);
+        if (exclude != nullptr) totals[j] -= exclude[j];
+    }
+    record(id, numitems, numiterations, totals.data());
+}
+
+void Snapshot::sample(double *values) {
+    counters.sample();
+    for (size_t j = 0; j < counters.size(); ++j) values[j] = counters[j];
+}
+
+void Snapshot::record(EventId id, uint64_t numitems, uint64_t numiterations,
+                      const double *values) {
+    if (numiterations == 0) return;
+    Record &record(records[id]);
+    if (log != nullptr) log->append(id, numitems, numiterations, values);
+    for (size_t j = 0; j < record.distributions.size(); ++j) {
+        record.distributions[j].add(values[j] / numiterations);
+    }
+    if (retain) {
+        std::size_t row = record.count++;
+        if (row >= record.N.size()) {
+            // Out of preallocated room, grow geometrically
+            std::size_t size = 2 * record.N.size() + 1;
+            record.N.resize(size);
+            for (std::vector<double> &column : record.columns) column.resize(size);
+        }
+        record.N[row] = numitems;
+        for (size_t j = 0; j < record.columns.size(); ++j) {
+            record.columns[j][row] = values[j] / numiterations;
+        }
+    }
+}
+
+Snapshot::EventId Snapshot::probeEvent(uint32_t probe, const char *name) {
+    if (probe >= probes.size()) probes.resize(probe + 1, NOEVENT);
+    if (probes[probe] == NOEVENT) probes[probe] = registerEvent(name);
+    return probes[probe];
+}
+
+Snapshot::EventId Snapshot::findProbeEvent(uint32_t probe) const {
+    return probe < probes.size() ? probes[probe] : NOEVENT;
+}
+
+// Moves the samples accumulated in the records into the event map
+void Snapshot::flush() const {
+    for (Record &record : records) {
+        bool sampled =
+            !record.distributions.empty() && (record.distributions[0].count() > 0);
+        if ((record.count == 0) && !sampled) continue;
+        Event &event(events[record.name]);
         if (event.metrics.empty()) {
-            event.name = event_name;
+            event.name = record.name;
             event.metrics.resize(counters.size());
             for (size_t j = 0; j < counters.size(); ++j) {
                 event.metrics[j].name = counters.name(j);
             }
         }
-        event.N.push_back(numitems);
-        for (size_t j = 0; j < counters.size(); ++j) {
-            double average = double(counters[j]) / numiterations;
-            event.metrics[j].values.push_back(average);
+        event.N.insert(event.N.end(), record.N.begin(), record.N.begin() + record.count);
+        for (size_t j = 0; j < record.columns.size(); ++j) {
+            const std::vector<double> &column(record.columns[j]);
+            std::vector<double> &values(event.metrics[j].values);
+            values.insert(values.end(), column.begin(), column.begin() + record.count);
         }
+        // Histograms are cumulative in the record
+        event.distributions = record.distributions;
+        record.count = 0;
     }
 }
 
 const Snapshot::EventMap &Snapshot::getEvents() const {
+    flush();
     return events;
 }
 
+const PerfGroup &Snapshot::getCounters() const {
+    return counters;
+}
+
+void Snapshot::setSampler(PerfSampler *s) {
+    sampler = s;
+}
+
+void Snapshot::setLog(SampleLog *l, bool keep) {
+    log = l;
+    retain = keep || (l == nullptr);
+    if (log == nullptr) return;
+    for (std::size_t j = 0; j < records.size(); ++j) {
+        log->define(j, records[j].name);
+    }
+}
+
+void Snapshot::calibrate(std::size_t numloops, bool subtract) {
+    overhead.assign(counters.size(), Overhead());
+    median_overhead.assign(counters.size(), 0);
+    // Goes through the same start()/stop() calls as a real measurement. The
+    // sampler is left out since its samples would need an event to go to.
+    PerfSampler *saved = sampler;
+    sampler = nullptr;
+    subtract_overhead = false;
+    for (std::size_t loop = 0; loop < numloops; ++loop) {
+        start();
+        stop(NOEVENT, 0, 1);
+        for (size_t j = 0; j < counters.size(); ++j) {
+            overhead[j].add(counters[j]);
+        }
+    }
+    for (size_t j = 0; j < counters.size(); ++j) {
+        median_overhead[j] = overhead[j].percentile(50);
+    }
+    sampler = saved;
+    last_iterations = 0;
+    subtract_overhead = subtract;
+}
+
+void Snapshot::setDistributions(bool enable) {
+    distributions = enable;
+    for (Record &record : records) {
+        if (enable) {
+            record.distributions.resize(counters.size());
+        } else {
+            record.distributions.clear();
+        }
+    }
+}
+
+void Snapshot::setSubtractOverhead(bool subtract) {
+    subtract_overhead = subtract && !median_overhead.empty();
+}
+
+const Snapshot::Overhead &Snapshot::getOverhead(std::size_t index) const {
+    return overhead.at(index);
+}
+
+// Counter total of the last measurement, net of the calibrated overhead
+double Snapshot::count(std::size_t index) const {
+    double value = counters[index];
+    if (subtract_overhead) {
+        value -= median_overhead[index];
+        if (value < 0) value = 0;
+    }
+    return value;
+}
+
 double Snapshot::operator[](std::size_t index) const {
     if (last_iterations == 0) return std::numeric_limits<double>::quiet_NaN();
-    return double(counters[index]) / last_iterations;
+    return count(index) / last_iterations;
 }
 
 double Snapshot::operator[](const char *key) const {
     if (last_iterations == 0) return std::numeric_limits<double>::quiet_NaN();
-    return double(counters[key]) / last_iterations;
+    size_t index = counters.index(key);
+    if (index == counters.size()) return double(counters[key]) / last_iterations;
+    return count(index) / last_iterations;
+}
+
+void Snapshot::merge(EventMap &dest, const EventMap &src) {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    for (const auto &ism : src) {
+        const Event &from(ism.second);
+        Event &to(dest[ism.first]);
+        if (to.name.empty()) to.name = from.name;
+        size_t rows = to.N.size();
+        to.N.insert(to.N.end(), from.N.begin(), from.N.end());
+        bool distributions = !to.distributions.empty() || !from.distributions.empty();
+        if (distributions) to.distributions.resize(to.metrics.size());
+        for (size_t j = 0; j < from.metrics.size(); ++j) {
+            const Metric &metric(from.metrics[j]);
+            size_t k = 0;
+            while ((k < to.metrics.size()) && (to.metrics[k].name != metric.name)) ++k;
+            if (k == to.metrics.size()) {
+                // New metric, missing from the rows already there
+                to.metrics.push_back(Metric{metric.name, std::vector<double>(rows, nan)});
+                if (distributions) to.distributions.emplace_back();
+            }
+            Metric &target(to.metrics[k]);
+            target.values.insert(target.values.end(), metric.values.begin(),
+                                 metric.values.end());
+            if (j < from.distributions.size()) {
+                to.distributions[k].merge(from.distributions[j]);
+            }
+        }
+        // Metrics missing from src, every metric stays as long as N
+        for (Metric &target : to.metrics) target.values.resize(to.N.size(), nan);
+    }
 }
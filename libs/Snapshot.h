@@ -7,6 +7,10 @@
 #include <unordered_map>
 #include <iostream>
 #include "PerfGroup.h"
+#include "MicroStats.h"
+
+class PerfSampler;
+class SampleLog;
 
 class Snapshot {
 public:
@@ -16,24 +20,129 @@ public:
         std::string name;
         std::vector<double> values;
     };
+    /** Distribution of the per-iteration values of one metric. Values are
+     * kept in fixed point, SCALE steps per unit, so fractional values such
+     * as 0.3 cache misses per iteration are not rounded away.
+     */
+    struct Distribution {
+        static constexpr double SCALE = 1024;
+        MicroStats<2> stats;
+        void add(double value) {
+            stats.add(value > 0 ? uint64_t(value * SCALE + 0.5) : 0);
+        }
+        void merge(const Distribution &other) {
+            stats.merge(other.stats);
+        }
+        double percentile(double pct) const {
+            return stats.percentile(pct) / SCALE;
+        }
+        uint64_t count() const {
+            return stats.count();
+        }
+    };
     struct Event {
         std::string name;
         std::vector<size_t> N;
         std::vector<Metric> metrics;
+        //! One per metric, only filled with setDistributions()
+        std::vector<Distribution> distributions;
     };
     using EventMap = std::map<EventName, Event>;
 
+    //! Handle for a pre-registered event, see registerEvent()
+    using EventId = std::uint32_t;
+    static constexpr EventId NOEVENT = ~EventId(0);
+
+    //! Distribution of the measurement cost of each counter
+    using Overhead = Distribution;
+
     Snapshot();
     Snapshot(const std::vector<std::string> &pmc);
+    Snapshot(const std::vector<std::string> &pmc, const PerfGroup::Options &options);
     ~Snapshot();
     void start();
     void stop(const char *event, uint64_t numitems, uint64_t numrep);
+
+    /** Registers an event name once and returns its handle. Storage for
+     * `capacity` samples is preallocated so stop(EventId,...) does neither
+     * allocation nor string lookups until that many samples were taken.
+     * Registering an existing name returns the same handle.
+     */
+    EventId registerEvent(const char *event, std::size_t capacity = 1024);
+    void stop(EventId event, uint64_t numitems, uint64_t numrep);
+    //! As above, first taking `exclude` (one total per counter) off the counts
+    void stop(EventId event, uint64_t numitems, uint64_t numrep, const double *exclude);
+
+    //! Reads the counter totals since start() without stopping them
+    void sample(double *values);
+    //! Stores a sample from explicit counter totals, as stop() would
+    void record(EventId event, uint64_t numitems, uint64_t numrep, const double *values);
+
+    //! Maps a process-wide probe id (see Probe.h) to an event of this
+    //! snapshot, registering the name on first use
+    EventId probeEvent(uint32_t probe, const char *name);
+    //! Event of a probe id if already registered, NOEVENT otherwise
+    EventId findProbeEvent(uint32_t probe) const;
     const EventMap &getEvents() const;
+    const PerfGroup &getCounters() const;
+
+    //! Samples every measured section with the given sampler, storing the
+    //! samples under the same event name. The sampler is not owned.
+    void setSampler(PerfSampler *sampler);
+
+    //! Streams every sample to the given log, which is not owned. Without
+    //! `retain` the samples are only written to the log, keeping memory
+    //! bounded on long runs; use SampleLog::read() to get them back.
+    void setLog(SampleLog *log, bool retain = true);
+
+    /** Measures the cost of an empty start()/stop() pair for every counter
+     * in the group, `numloops` times, through the same code path as a real
+     * sample. With `subtract` set, the median overhead is removed from the
+     * counter totals of every later stop().
+     */
+    void calibrate(std::size_t numloops = 10000, bool subtract = false);
+    /** Also keeps a histogram per metric of the per-iteration values of
+     * every sample, exposed in Event::distributions. They are kept even when
+     * samples only go to the log, so tails stay available on long runs at a
+     * fixed memory cost.
+     */
+    void setDistributions(bool enable);
+    //! Turns subtraction of the calibrated overhead on or off
+    void setSubtractOverhead(bool subtract);
+    //! Calibrated overhead distribution for the given counter
+    const Overhead &getOverhead(std::size_t index) const;
     double operator[](std::size_t index) const;
     double operator[](const char *key) const;
 
+    //! Appends all samples in src to dest, matching metrics by name. Metrics
+    //! found on one side only are padded with NaN to stay as long as N.
+    static void merge(EventMap &dest, const EventMap &src);
+
 private:
+    //! Samples of one registered event stored column-wise, one column per counter
+    struct Record {
+        std::string name;
+        std::size_t count = 0;
+        std::vector<uint64_t> N;
+        std::vector<std::vector<double>> columns;
+        std::vector<Distribution> distributions;
+    };
+    //! Stores the sample of the counters just stopped
+    void finish(EventId event, uint64_t numitems, uint64_t numrep, const double *exclude);
+    void flush() const;
+    double count(std::size_t index) const;
+
     PerfGroup counters;
-    EventMap events;
+    PerfSampler *sampler = nullptr;
+    SampleLog *log = nullptr;
+    bool retain = true;
+    std::vector<double> totals;
+    std::vector<EventId> probes;
+    mutable std::vector<Record> records;
+    mutable EventMap events;
     std::size_t last_iterations = 0;
+    std::vector<Overhead> overhead;
+    std::vector<double> median_overhead;
+    bool subtract_overhead = false;
+    bool distributions = false;
 };
@@ -0,0 +1,184 @@
+#include "Telemetry.h"
+#include "TimingUtils.h"
+#include <iostream>
+#include <unistd.h>
+
+using namespace telemetry;
+
+static SlotHeader *slot_header(void *base, uint32_t slotsize, uint32_t slot) {
+    char *ptr = static_cast<char *>(base) + sizeof(Header);
+    return reinterpret_cast<SlotHeader *>(ptr + std::size_t(slot) * slotsize);
+}
+
+bool TelemetryWriter::init(const std::string &name, uint32_t numslots,
+                           uint32_t slotsize) {
+    // Keep the payloads 8-byte aligned
+    slotsize = (slotsize + 7) & ~7U;
+    if (slotsize <= sizeof(SlotHeader)) {
+        std::cerr << "TelemetryWriter: slot size " << slotsize << " is too small\n";
+        return false;
+    }
+    _header = nullptr;
+    _slots.clear();
+    if (!_map.init(name, sizeof(Header) + std::size_t(numslots) * slotsize)) return false;
+    _header = static_cast<Header *>(_map.data());
+    memcpy(_header->magic, MAGIC, sizeof(MAGIC));
+    _header->numslots = numslots;
+    _header->slotsize = slotsize;
+    _header->used = 0;
+    _header->pid = ::getpid();
+    // Readers check the version last
+    __atomic_store_n(&_header->version, VERSION, __ATOMIC_RELEASE);
+    _slots.clear();
+    return true;
+}
+
+int TelemetryWriter::slot(const std::string &name) {
+    auto it = _slots.find(name);
+    if (it != _slots.end()) return it->second;
+    if (_header == nullptr) return -1;
+    uint32_t index = _header->used;
+    if (index >= _header->numslots) {
+        std::cerr << "TelemetryWriter: no free slot for [" << name << "]\n";
+        return -1;
+    }
+    SlotHeader *h = slot_header(_header, _header->slotsize, index);
+    strncpy(h->name, name.c_str(), NAMESIZE - 1);
+    h->kind = Empty;
+    __atomic_store_n(&_header->used, index + 1, __ATOMIC_RELEASE);
+    _slots[name] = index;
+    return index;
+}
+
+bool TelemetryWriter::write(int slot, uint32_t kind, uint32_t param, const void *data,
+                            uint32_t size) {
+    if ((_header == nullptr) || (slot < 0) || (uint32_t(slot) >= _header->used)) {
+        return false;
+    }
+    if (size > capacity()) {
+        std::cerr << "TelemetryWriter: " << size << " bytes do not fit in slot "
+                  << slot << '\n';
+        return false;
+    }
+    SlotHeader *h = slot_header(_header, _header->slotsize, slot);
+    uint64_t seq = h->seq.load(std::memory_order_relaxed);
+    h->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    h->kind = kind;
+    h->param = param;
+    h->size = size;
+    h->timestamp = utcnow();
+    memcpy(reinterpret_cast<char *>(h + 1), data, size);
+    h->seq.store(seq + 2, std::memory_order_release);
+    return true;
+}
+
+uint32_t TelemetryWriter::capacity() const {
+    return (_header == nullptr) ? 0 : _header->slotsize - sizeof(SlotHeader);
+}
+
+std::vector<int> TelemetryWriter::slots(const std::string &prefix,
+                                        const PerfGroup &group) {
+    std::vector<int> result(group.size());
+    for (size_t j = 0; j < group.size(); ++j) {
+        result[j] = slot(prefix + "." + group.name(j));
+    }
+    return result;
+}
+
+bool TelemetryWriter::publish(const std::vector<int> &slots, const PerfGroup &group) {
+    bool ok = slots.size() == group.size();
+    for (size_t j = 0; ok && (j < group.size()); ++j) {
+        double values[3] = {double(group[j]), double(group.raw(j)), group.ratio(j)};
+        ok &= publish(slots[j], values, 3);
+    }
+    return ok;
+}
+
+bool TelemetryReader::open(const std::string &name) {
+    _header = nullptr;
+    if (!_map.open(name)) return false;
+    const Header *header = static_cast<const Header *>(_map.data());
+    if ((_map.size() < sizeof(Header)) ||
+        (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0) ||
+        (__atomic_load_n(&header->version, __ATOMIC_ACQUIRE) != VERSION) ||
+        (_map.size() <
+         sizeof(Header) + std::size_t(header->numslots) * header->slotsize)) {
+        std::cerr << "TelemetryReader: [" << name << "] is not a telemetry segment\n";
+        _map.close();
+        return false;
+    }
+    _header = header;
+    return true;
+}
+
+uint32_t TelemetryReader::size() const {
+    if (_header == nullptr) return 0;
+    return __atomic_load_n(&_header->used, __ATOMIC_ACQUIRE);
+}
+
+const SlotHeader *TelemetryReader::header(uint32_t slot) const {
+    if (slot >= size()) return nullptr;
+    return slot_header(_map.data(), _header->slotsize, slot);
+}
+
+std::string TelemetryReader::name(uint32_t slot) const {
+    const SlotHeader *h = header(slot);
+    if (h == nullptr) return std::string();
+    return std::string(h->name, strnlen(h->name, NAMESIZE));
+}
+
+uint32_t TelemetryReader::kind(uint32_t slot) const {
+    const SlotHeader *h = header(slot);
+    if (h == nullptr) return Empty;
+    return __atomic_load_n(&h->kind, __ATOMIC_RELAXED);
+}
+
+int TelemetryReader::find(const std::string &metric) const {
+    for (uint32_t j = 0; j < size(); ++j) {
+        if (name(j) == metric) return j;
+    }
+    return -1;
+}
+
+bool TelemetryReader::copy(uint32_t slot, uint32_t kind, uint32_t param,
+                           std::vector<uint8_t> &data) const {
+    const SlotHeader *h = header(slot);
+    if (h == nullptr) return false;
+    // Bounded so a writer that died mid-update does not hang the reader
+    for (uint32_t attempt = 0; attempt < 100000; ++attempt) {
+        uint64_t seq = h->seq.load(std::memory_order_acquire);
+        if (seq & 1) continue;
+        uint32_t size = h->size;
+        bool match = (h->kind == kind) && (h->param == param) &&
+                     (size <= _header->slotsize - sizeof(SlotHeader));
+        if (match) {
+            data.resize(size);
+            memcpy(data.data(), h + 1, size);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (h->seq.load(std::memory_order_relaxed) == seq) return match;
+    }
+    return false;
+}
+
+bool TelemetryReader::read(uint32_t slot, std::vector<double> &values) const {
+    const SlotHeader *h = header(slot);
+    if (h == nullptr) return false;
+    for (uint32_t attempt = 0; attempt < 100000; ++attempt) {
+        uint64_t seq = h->seq.load(std::memory_order_acquire);
+        if (seq & 1) continue;
+        if (h->kind != Values) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (h->seq.load(std::memory_order_relaxed) == seq) return false;
+            continue;
+        }
+        uint32_t count = h->param;
+        if (count * sizeof(double) > _header->slotsize - sizeof(SlotHeader)) continue;
+        values.resize(count);
+        memcpy(values.data(), h + 1, values.size() * sizeof(double));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (h->seq.load(std::memory_order_relaxed) == seq) return true;
+    }
+    return false;
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "MMapFile.h"
+#include "MicroStats.h"
+#include "PerfGroup.h"
+
+/** Layout of the POSIX shared memory segment used to publish live stats.
+ * A header is followed by fixed-size slots, each holding one named metric.
+ * Histograms go in their sparse encoding, so a slot holds any MicroStats
+ * whose non-empty bins fit, regardless of its NDB.
+ * Every slot is guarded by its own seqlock: the writer makes the sequence
+ * odd, copies the payload and makes it even again, so readers in other
+ * processes retry until they see the same even value on both sides.
+ */
+namespace telemetry {
+
+constexpr char MAGIC[8] = {'T', 'P', 'T', 'E', 'L', 'E', 'M', 0};
+constexpr uint32_t VERSION = 2;
+constexpr std::size_t NAMESIZE = 48;
+
+enum Kind : uint32_t {
+    Empty = 0,
+    Histogram = 1,  //! MicroStats<param> as encoded by MicroStats::serialize()
+    Values = 2,     //! Array of doubles
+};
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t numslots;
+    uint32_t slotsize;  //! Bytes per slot, including the SlotHeader
+    uint32_t used;      //! Slots allocated so far
+    int64_t pid;
+};
+
+struct SlotHeader {
+    std::atomic<uint64_t> seq;
+    char name[NAMESIZE];
+    uint32_t kind;
+    uint32_t param;  //! NDB for histograms, number of values otherwise
+    uint32_t size;   //! Payload bytes
+    uint32_t reserved;
+    int64_t timestamp;  //! UTC nanoseconds of the last update
+};
+
+}  // namespace telemetry
+
+/** Publishes MicroStats histograms and PerfGroup counters into a shared
+ * memory segment. Updates are a memcpy between two stores, with no
+ * syscalls, no locks and, once warmed up, no allocations. Slots are
+ * allocated by name on first publish and must all be published from the
+ * same thread. Calling init() again replaces the segment.
+ */
+class TelemetryWriter {
+public:
+    //! Creates the segment /dev/shm/<name> with room for numslots metrics
+    bool init(const std::string &name, uint32_t numslots = 256,
+              uint32_t slotsize = 16384);
+
+    //! Returns the slot for a metric, allocating it on first use, or -1
+    int slot(const std::string &name);
+
+    //! Publishes the non-empty bins only, with their sums if they fit
+    template <uint32_t NDB>
+    bool publish(int slot, const MicroStats<NDB> &hist) {
+        _buffer.clear();
+        hist.serialize(_buffer, true);
+        if (_buffer.size() > capacity()) {
+            _buffer.clear();
+            hist.serialize(_buffer, false);
+        }
+        return write(slot, telemetry::Histogram, NDB, _buffer.data(), _buffer.size());
+    }
+    bool publish(int slot, const double *values, uint32_t count) {
+        return write(slot, telemetry::Values, count, values, count * sizeof(double));
+    }
+
+    template <uint32_t NDB>
+    bool publish(const std::string &name, const MicroStats<NDB> &hist) {
+        return publish(slot(name), hist);
+    }
+
+    //! Returns the slots of every counter of the group, named
+    //! "<prefix>.<event>", to be resolved once and passed to publish()
+    std::vector<int> slots(const std::string &prefix, const PerfGroup &group);
+    //! Publishes every counter of the group into its slot, each with its
+    //! scaled value, raw value and running ratio
+    bool publish(const std::vector<int> &slots, const PerfGroup &group);
+
+private:
+    //! Payload bytes a slot can hold
+    uint32_t capacity() const;
+    bool write(int slot, uint32_t kind, uint32_t param, const void *data,
+               uint32_t size);
+    MMapFile _map;
+    telemetry::Header *_header = nullptr;
+    std::unordered_map<std::string, int> _slots;
+    std::vector<uint8_t> _buffer;  //! Encoded histogram, reused
+};
+
+//! Reads a segment published by TelemetryWriter, possibly from another process
+class TelemetryReader {
+public:
+    bool open(const std::string &name);
+
+    //! Number of slots allocated by the writer so far
+    uint32_t size() const;
+    std::string name(uint32_t slot) const;
+    uint32_t kind(uint32_t slot) const;
+    //! Slot of the named metric or -1
+    int find(const std::string &name) const;
+
+    template <uint32_t NDB>
+    bool read(uint32_t slot, MicroStats<NDB> &hist) const {
+        std::vector<uint8_t> data;
+        if (!copy(slot, telemetry::Histogram, NDB, data)) return false;
+        return hist.deserialize(data.data(), data.size());
+    }
+    bool read(uint32_t slot, std::vector<double> &values) const;
+
+private:
+    const telemetry::SlotHeader *header(uint32_t slot) const;
+    bool copy(uint32_t slot, uint32_t kind, uint32_t param,
+              std::vector<uint8_t> &data) const;
+    MMapFile _map;
+    const telemetry::Header *_header = nullptr;
+};
@@ -0,0 +1,113 @@
+#include "ThreadSnapshot.h"
+#include <atomic>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// Each live instance holds an id that indexes the per-thread table below, so
+// the table is as large as the most instances alive at once. Ids are reused
+// once their instance is destroyed, and a thread may still hold the entry of
+// the previous owner, so entries also carry the never reused serial number
+// of their instance and are only trusted when it matches.
+namespace {
+struct LocalSnapshot {
+    std::size_t serial = 0;
+    Snapshot *snap = nullptr;
+};
+struct IdPool {
+    std::mutex mutex;
+    std::vector<std::size_t> free;
+    std::size_t size = 0;
+};
+}  // namespace
+
+static std::atomic<std::size_t> next_serial{1};
+static thread_local std::vector<LocalSnapshot> local_snapshots;
+
+static IdPool &id_pool() {
+    static IdPool pool;
+    return pool;
+}
+
+static std::size_t acquire_id() {
+    IdPool &pool(id_pool());
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (pool.free.empty()) return pool.size++;
+    std::size_t id = pool.free.back();
+    pool.free.pop_back();
+    return id;
+}
+
+static void release_id(std::size_t id) {
+    IdPool &pool(id_pool());
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.free.push_back(id);
+}
+
+ThreadSnapshot::ThreadSnapshot()
+    : ThreadSnapshot({"cycles", "instructions", "cache-misses", "branch-misses"}) {
+}
+
+ThreadSnapshot::ThreadSnapshot(const std::vector<std::string> &pmc)
+    : ThreadSnapshot(pmc, PerfGroup::Options()) {
+}
+
+ThreadSnapshot::ThreadSnapshot(const std::vector<std::string> &pmc,
+                               const PerfGroup::Options &options)
+    : _pmc(pmc), _options(options), _id(acquire_id()), _serial(next_serial++) {
+    _options.inherit = false;
+}
+
+ThreadSnapshot::~ThreadSnapshot() {
+    release_id(_id);
+}
+
+void ThreadSnapshot::start() {
+    local().start();
+}
+
+void ThreadSnapshot::stop(const char *event, uint64_t numitems, uint64_t numrep) {
+    local().stop(event, numitems, numrep);
+}
+
+Snapshot &ThreadSnapshot::local() {
+    if ((_id < local_snapshots.size()) && (local_snapshots[_id].serial == _serial)) {
+        return *local_snapshots[_id].snap;
+    }
+    return create();
+}
+
+Snapshot &ThreadSnapshot::create() {
+    // The counters have to be opened by the thread they will count
+    std::unique_ptr<Slot> slot(new Slot);
+    slot->tid = ::syscall(SYS_gettid);
+    char name[16] = {};
+    if (::pthread_getname_np(::pthread_self(), name, sizeof(name)) == 0) {
+        slot->name = name;
+    }
+    slot->snap.reset(new Snapshot(_pmc, _options));
+    Snapshot *snap = slot->snap.get();
+    if (local_snapshots.size() <= _id) local_snapshots.resize(_id + 1);
+    local_snapshots[_id] = LocalSnapshot{_serial, snap};
+    std::lock_guard<std::mutex> lock(_mutex);
+    _slots.push_back(std::move(slot));
+    return *snap;
+}
+
+Snapshot::EventMap ThreadSnapshot::getEvents() const {
+    Snapshot::EventMap events;
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (const auto &slot : _slots) {
+        Snapshot::merge(events, slot->snap->getEvents());
+    }
+    return events;
+}
+
+std::vector<ThreadSnapshot::ThreadEvents> ThreadSnapshot::getThreadEvents() const {
+    std::vector<ThreadEvents> result;
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (const auto &slot : _slots) {
+        result.push_back(ThreadEvents{slot->tid, slot->name, slot->snap->getEvents()});
+    }
+    return result;
+}
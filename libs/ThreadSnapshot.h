@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "Snapshot.h"
+
+/** A Snapshot that can be shared by several threads. Each thread lazily gets
+ * its own counter group, opened without inherit so it counts that thread only,
+ * and its own sample storage. start()/stop() never take a lock; only the first
+ * call on each thread does, to register it.
+ * The results can be aggregated or broken down per thread but should only be
+ * collected once the worker threads are done measuring.
+ */
+class ThreadSnapshot {
+public:
+    //! The samples collected by one thread
+    struct ThreadEvents {
+        pid_t tid;
+        std::string name;
+        Snapshot::EventMap events;
+    };
+
+    ThreadSnapshot();
+    ThreadSnapshot(const std::vector<std::string> &pmc);
+    ThreadSnapshot(const std::vector<std::string> &pmc,
+                   const PerfGroup::Options &options);
+    ~ThreadSnapshot();
+
+    void start();
+    void stop(const char *event, uint64_t numitems, uint64_t numrep);
+
+    //! Returns the calling thread's snapshot, creating it on first use
+    Snapshot &local();
+
+    //! Returns the samples of all threads merged by event name
+    Snapshot::EventMap getEvents() const;
+
+    //! Returns the samples of each thread separately
+    std::vector<ThreadEvents> getThreadEvents() const;
+
+private:
+    struct Slot {
+        pid_t tid;
+        std::string name;
+        std::unique_ptr<Snapshot> snap;
+    };
+    Snapshot &create();
+
+    std::vector<std::string> _pmc;
+    PerfGroup::Options _options;
+    std::size_t _id;      //! Index in the per-thread tables, reused
+    std::size_t _serial;  //! Unique to this instance
+    mutable std::mutex _mutex;
+    std::vector<std::unique_ptr<Slot>> _slots;
+};
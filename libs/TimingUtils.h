@@ -74,8 +74,10 @@ inline void DoNotOptimize(T const& value) {
     asm volatile("" : : "r,m"(value) : "memory");
 }
 
+//! Times fn() `loops` times. `overhead` (see tic_overhead) is taken off
+//! every elapsed time before dividing by the count returned by fn()
 template <typename Fn, typename HistT>
-void timeit(HistT& hist, const std::uint32_t loops, Fn&& fn) {
+void timeit(HistT& hist, const std::uint32_t loops, Fn&& fn, double overhead = 0) {
     for (std::uint32_t j = 0; j < loops; ++j) {
         std::uint64_t t0 = tic();
         mfence();
@@ -84,12 +86,13 @@ void timeit(HistT& hist, const std::uint32_t loops, Fn&& fn) {
         mfence();
         disable_reorder();
         std::uint64_t t1 = tic();
-        hist.add(double(t1 - t0) / count);
+        double elapsed = double(t1 - t0) - overhead;
+        hist.add(elapsed > 0 ? elapsed / count : 0);
     }
 }
 
 template <typename Fn, typename HistT>
-double timeit(HistT& hist, Fn&& fn) {
+double timeit(HistT& hist, Fn&& fn, double overhead = 0) {
     mfence();
     std::uint64_t t0 = tic();
     disable_reorder();
@@ -97,11 +100,20 @@ double timeit(HistT& hist, Fn&& fn) {
     disable_reorder();
     mfence();
     std::uint64_t t1 = tic();
-    double elapsed = double(t1) - double(t0);
+    double elapsed = double(t1) - double(t0) - overhead;
+    if (elapsed < 0) elapsed = 0;
     hist.add(elapsed / count);
     return elapsed;
 }
 
+//! Measures an empty timeit() `loops` times into hist and returns the median,
+//! to be passed back as the overhead argument of timeit()
+template <typename HistT>
+double tic_overhead(HistT& hist, const std::uint32_t loops = 100000) {
+    timeit(hist, loops, []() { return 1; });
+    return hist.percentile(50);
+}
+
 template <typename Fn>
 void busyWait(uint64_t ticks, Fn fn) {
     uint64_t start = tic();
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "MicroStats.h"
+#include "TimingUtils.h"
+
+/**
+ * Sliding-window MicroStats. Time is cut into buckets of fixed width, each
+ * with its own histogram, kept in a ring. Buckets are recycled lazily when
+ * the clock moves into them, so add() stays a MicroStats::add() plus a
+ * division. A window query merges the live buckets, O(bins) each, without
+ * ever storing raw samples, into a histogram kept for that purpose, so
+ * queries are not const and return references valid until the next one.
+ *
+ * Timestamps can be in any unit as long as bucketwidth uses the same:
+ * nanoseconds from nowts(), the default, or ticks from tic().
+ */
+template <uint32_t NDB>
+class WindowedMicroStats {
+public:
+    using Stats = MicroStats<NDB>;
+
+    //! Window of numbuckets buckets of bucketwidth each, e.g. 10 x 1s
+    WindowedMicroStats(int64_t bucketwidth, uint32_t numbuckets)
+        : width(bucketwidth), buckets(numbuckets), scratch(new Stats()) {
+        for (Bucket& bucket : buckets) bucket.stats.reset(new Stats());
+    }
+
+    //! Adds a value timestamped now by nowts()
+    void add(uint64_t value) {
+        add(value, nowts());
+    }
+
+    //! Adds a value with the caller's timestamp. Values a whole ring late,
+    //! whose bucket already holds newer data, are dropped.
+    void add(uint64_t value, int64_t now) {
+        int64_t epoch = now / width;
+        Bucket& bucket(buckets[epoch % buckets.size()]);
+        if (epoch < bucket.epoch) return;
+        if (bucket.epoch != epoch) {
+            bucket.stats->clear();
+            bucket.epoch = epoch;
+        }
+        bucket.stats->add(value);
+    }
+
+    //! Merges the last numbuckets buckets up to now, the current one
+    //! included. Zero means the whole ring. The result stays valid until
+    //! the next query.
+    const Stats& window(int64_t now, uint32_t numbuckets = 0) {
+        scratch->clear();
+        merge(*scratch, now, numbuckets);
+        return *scratch;
+    }
+    const Stats& window() {
+        return window(nowts());
+    }
+
+    //! Same as window() but into the caller's histogram, which is not cleared
+    void merge(Stats& stats, int64_t now, uint32_t numbuckets = 0) const {
+        if ((numbuckets == 0) || (numbuckets > buckets.size())) {
+            numbuckets = buckets.size();
+        }
+        int64_t last = now / width;
+        for (const Bucket& bucket : buckets) {
+            if ((bucket.epoch <= last) && (bucket.epoch > last - numbuckets)) {
+                stats.merge(*bucket.stats);
+            }
+        }
+    }
+
+    //! Percentile over the whole window ending now
+    double percentile(double pct) {
+        return window().percentile(pct);
+    }
+
+    //! Same as percentile() for n ranks in increasing order, from one merge
+    void percentiles(const double* pcts, double* out, std::size_t n) {
+        window().percentiles(pcts, out, n);
+    }
+
+    //! Prints the percentiles of the whole window ending now
+    void print(std::ostream& oss) {
+        window().print(oss);
+    }
+
+    //! Drops all buckets
+    void clear() {
+        for (Bucket& bucket : buckets) {
+            bucket.stats->clear();
+            bucket.epoch = NOEPOCH;
+        }
+    }
+
+    //! Time covered by a full window
+    int64_t span() const {
+        return width * int64_t(buckets.size());
+    }
+
+private:
+    static constexpr int64_t NOEPOCH = INT64_MIN;
+    struct Bucket {
+        int64_t epoch = NOEPOCH;
+        std::unique_ptr<Stats> stats;
+    };
+    int64_t width;
+    std::vector<Bucket> buckets;
+    std::unique_ptr<Stats> scratch;  //! Merged window, on the heap as it is large
+};
+
+/**
+ * MicroStats where every value loses weight exponentially with age, with
+ * the given half-life. Uses forward decay: instead of scaling every bin
+ * down as time passes, new values are added with a weight that grows as
+ * exp(age/tau) from a landmark time. Only when that weight gets too large
+ * are the bins scaled down once and the landmark moved, so add() is O(1).
+ * Timestamps follow the same rules as WindowedMicroStats.
+ */
+template <uint32_t NDB>
+class DecayingMicroStats {
+public:
+    using Layout = MicroStats<NDB>;
+    static constexpr uint32_t NUMBINS = Layout::NUMBINS;
+
+    explicit DecayingMicroStats(double halflife) : rate(std::log(2.0) / halflife) {
+        clear();
+    }
+
+    //! Adds a value timestamped now by nowts()
+    void add(uint64_t value) {
+        add(value, nowts());
+    }
+
+    //! Adds a value with the caller's timestamp, expected not to go back
+    void add(uint64_t value, int64_t now) {
+        double w = weight(now);
+        uint32_t j = Layout::calcbin(value);
+        weights[j] += w;
+        sums[j] += w * value;
+        sum2s[j] += w * double(value) * value;
+        totalweight += w;
+        totalsum += w * value;
+    }
+
+    /** Percentile of the decayed distribution. The bin is found with one
+     * pass over the running weights, then the value is placed within the
+     * bin from its weighted moments, as MicroStats does with counts.
+     */
+    double percentile(double pct) const {
+        double value;
+        percentiles(&pct, &value, 1);
+        return value;
+    }
+
+    //! Same as percentile() for n ranks in increasing order, in one pass
+    void percentiles(const double* pcts, double* out, std::size_t n) const {
+        double running = 0;
+        uint32_t j = 0;
+        uint32_t last = NUMBINS;  // Last non-empty bin seen
+        for (std::size_t k = 0; k < n; ++k) {
+            if (totalweight <= 0) {
+                out[k] = 0;
+                continue;
+            }
+            double goal = pcts[k] * totalweight / 100.0;
+            // Empty bins never hold a rank, even one at or below zero
+            while ((j < NUMBINS) &&
+                   ((weights[j] <= 0) || (running + weights[j] < goal))) {
+                if (weights[j] > 0) last = j;
+                running += weights[j];
+                ++j;
+            }
+            if (j >= NUMBINS) {
+                // The running weights fell short of the total by rounding
+                out[k] = last < NUMBINS ? Layout::calcrange(last).to : -1;
+                continue;
+            }
+            typename Layout::Range range = Layout::calcrange(j);
+            double binweight = weights[j];
+            double ratio = (goal - running) / binweight;
+            // Integer values stand for the unit interval around them
+            double value = percentile::interpolate(range.from - 0.5, range.to + 0.5,
+                                                   binweight, sums[j],
+                                                   sum2s[j] + binweight / 12.0, ratio);
+            out[k] = std::min<double>(range.to, std::max<double>(range.from, value));
+        }
+    }
+
+    //! Decayed average
+    double average() const {
+        return totalsum / totalweight;
+    }
+
+    //! Effective number of values, i.e. the sum of their weights as of now
+    double count(int64_t now) const {
+        return totalweight * std::exp(-rate * double(now - landmark));
+    }
+
+    void clear() {
+        weights.fill(0);
+        sums.fill(0);
+        sum2s.fill(0);
+        totalweight = 0;
+        totalsum = 0;
+        landmark = NOLANDMARK;
+    }
+
+    //! Prints the histogram's values as percentiles
+    void print(std::ostream& oss) const {
+        static const double pcts[] = {1, 10, 25, 50, 75, 90, 99};
+        double values[7];
+        percentiles(pcts, values, 7);
+        for (uint32_t k = 0; k < 7; ++k) {
+            oss << pcts[k] << "%," << values[k] << ",";
+        }
+    }
+
+    friend inline std::ostream& operator<<(std::ostream& out,
+                                           const DecayingMicroStats& ms) {
+        ms.print(out);
+        return out;
+    }
+
+private:
+    //! Weight of a value added at now, moving the landmark when it overflows
+    double weight(int64_t now) {
+        if (landmark == NOLANDMARK) landmark = now;
+        double w = std::exp(rate * double(now - landmark));
+        if (w > MAXWEIGHT) {
+            double scale = 1.0 / w;
+            for (uint32_t j = 0; j < NUMBINS; ++j) {
+                weights[j] *= scale;
+                sums[j] *= scale;
+                sum2s[j] *= scale;
+            }
+            totalweight *= scale;
+            totalsum *= scale;
+            landmark = now;
+            w = 1;
+        }
+        return w;
+    }
+
+    static constexpr int64_t NOLANDMARK = INT64_MIN;
+    static constexpr double MAXWEIGHT = 1e100;
+    double rate;                             //! ln(2)/half-life
+    int64_t landmark;                        //! Time at which weights are 1
+    std::array<double, NUMBINS> weights;     //! Decayed count per bin
+    std::array<double, NUMBINS> sums;        //! Weighted sum of the values per bin
+    std::array<double, NUMBINS> sum2s;       //! Same for the squared values
+    double totalweight;                      //! Sum of all weights
+    double totalsum;                         //! Weighted sum of all values
+};
@@ -172,8 +172,8 @@ void calcResults() {
     std::uint32_t sum = 0;
     for (std::uint32_t size : sizes) {
         for (std::uint32_t stride : strides) {
-            Histogram<Policy::HistogramBins> hist(Policy::HistogramRange[0],
-                                                  Policy::HistogramRange[1]);
+            FastHistogram<Policy::HistogramBins> hist(Policy::HistogramRange[0],
+                                                      Policy::HistogramRange[1]);
             hist.clear();
             if (size > 2 * stride) {
                 std::vector<std::uint32_t> vpos(size);
@@ -10,6 +10,7 @@
 #include <vector>
 #include <unordered_map>
 #include <chrono>
+#include <thread>
 
 #include "Snapshot.h"
 #include "Allocators.h"
@@ -62,6 +63,7 @@ void testme(const std::string& key, Snapshot& snap,
     }
 
     // Loop measuring lookups
+    Snapshot::EventId event = snap.registerEvent(key.c_str());
     double start = nowts();
     snap.start();
     uint64_t counter = 0;
@@ -72,7 +74,7 @@ void testme(const std::string& key, Snapshot& snap,
             counter++;
         }
     } while (nowts() < start + runsecs);
-    snap.stop(key.c_str(), numtickers, counter);
+    snap.stop(event, numtickers, counter);
 
     // The sum of all counters has to match
     for (auto& ev : bookmap) {
@@ -81,6 +83,44 @@ void testme(const std::string& key, Snapshot& snap,
     assert(counter == 0);
 }
 
+// Multi-threaded run: every thread owns a map but all maps share the one
+// allocator, and each pass rebuilds the map so the allocator is exercised
+template <class MapType>
+void testmt(const std::string& key, const std::vector<TickerInfo>& tickers,
+            uint32_t numevents, uint32_t numtickers, uint32_t numthreads,
+            double runsecs) {
+    typename MapType::allocator_type alloc;
+    std::vector<uint64_t> counters(numthreads, 0);
+    auto worker = [&](uint32_t id) {
+        boost::random::mt19937 rng(id);
+        boost::random::uniform_int_distribution<> chance(0, numtickers - 1);
+        std::vector<Ticker> packets(numevents);
+        for (Ticker& ticker : packets) ticker = tickers[chance(rng)].ticker;
+        uint64_t counter = 0;
+        double start = nowts();
+        do {
+            MapType bookmap(alloc);
+            for (uint32_t j = 0; j < numtickers; ++j) {
+                bookmap[tickers[j].ticker].count = 0;
+            }
+            for (const Ticker& ticker : packets) {
+                bookmap[ticker].count += 1;
+                counter++;
+            }
+        } while (nowts() < start + runsecs * 1E9);
+        counters[id] = counter;
+    };
+    double start = nowts();
+    std::vector<std::thread> threads;
+    for (uint32_t id = 0; id < numthreads; ++id) threads.emplace_back(worker, id);
+    for (std::thread& thread : threads) thread.join();
+    double elapsed = nowts() - start;
+    uint64_t total = 0;
+    for (uint64_t counter : counters) total += counter;
+    std::cout << "Threads," << numthreads << ",Tickers," << numtickers << "," << key
+              << ",Mlookups/s," << total * 1E3 / elapsed << '\n';
+}
+
 // All our containers, templated by allocator type
 template <class Allocator>
 using BoostFlatMapType =
@@ -98,6 +138,10 @@ using mmaped = retail_allocator<std::pair<Ticker, OrderBook>, mmap_allocator>;
 using transp = retail_allocator<std::pair<Ticker, OrderBook>, transparent_allocator>;
 using hugepage = retail_allocator<std::pair<Ticker, OrderBook>, hugepage_allocator>;
 using boostpmr = BoostAllocator<std::pair<const Ticker, OrderBook>>;
+using threaded =
+    threaded_retail_allocator<std::pair<const Ticker, OrderBook>, standard_allocator>;
+using threadhuge =
+    threaded_retail_allocator<std::pair<const Ticker, OrderBook>, transparent_allocator>;
 
 int main(int argc, char* argv[]) {
     // Read all tickers from string into a vector
@@ -182,4 +226,25 @@ int main(int argc, char* argv[]) {
 
     // Print summary
     summary(snap.getEvents(), "Map");
+
+    // Scaling across threads, only with the allocators that are thread safe
+    uint32_t maxthreads = std::max(1U, std::thread::hardware_concurrency());
+    for (uint32_t numthreads = 1; numthreads <= maxthreads; numthreads *= 2) {
+        for (uint32_t numtickers = 1000; numtickers <= 4000; numtickers *= 2) {
+            testmt<StdMapType<stdalloc>>("std::map<std::alloc>", tickers, numevents,
+                                         numtickers, numthreads, runsecs);
+            testmt<StdMapType<threaded>>("std::map<threaded::std>", tickers, numevents,
+                                         numtickers, numthreads, runsecs);
+            testmt<StdMapType<threadhuge>>("std::map<threaded::thp>", tickers,
+                                           numevents, numtickers, numthreads, runsecs);
+            testmt<StdHashMapType<stdalloc>>("std::unordered_map<std::alloc>", tickers,
+                                             numevents, numtickers, numthreads, runsecs);
+            testmt<StdHashMapType<threaded>>("std::unordered_map<threaded::std>",
+                                             tickers, numevents, numtickers, numthreads,
+                                             runsecs);
+            testmt<StdHashMapType<threadhuge>>("std::unordered_map<threaded::thp>",
+                                               tickers, numevents, numtickers,
+                                               numthreads, runsecs);
+        }
+    }
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <map>
 #include <set>
 #include <algorithm>
+#include <thread>
 
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int_distribution.hpp>
@@ -38,6 +39,37 @@ void testme(const std::string& testname, Snapshot& snap,
 #endif
 }
 
+// Multi-threaded run: every thread counts words into its own map, rebuilt
+// on each pass, with all maps drawing from one shared allocator
+template <template <typename Key, typename Value, typename AllocType> class MapType,
+          template <typename ValueType> class AllocatorType>
+void testmt(const std::string& testname, const std::vector<std::string_view>& allwords,
+            uint32_t numwords, uint32_t numthreads, double runsecs) {
+    using KeyValuePair = std::pair<const std::string_view, Counter<int>>;
+    using Map = MapType<std::string_view, Counter<int>, AllocatorType<KeyValuePair>>;
+    AllocatorType<KeyValuePair> alloc;
+    std::vector<uint64_t> counters(numthreads, 0);
+    auto worker = [&](uint32_t id) {
+        uint64_t counter = 0;
+        double start = nowts();
+        do {
+            Map words(alloc);
+            for (std::string_view w : allwords) words[w]++;
+            counter += allwords.size();
+        } while (nowts() < start + runsecs * 1E9);
+        counters[id] = counter;
+    };
+    double start = nowts();
+    std::vector<std::thread> threads;
+    for (uint32_t id = 0; id < numthreads; ++id) threads.emplace_back(worker, id);
+    for (std::thread& thread : threads) thread.join();
+    double elapsed = nowts() - start;
+    uint64_t total = 0;
+    for (uint64_t counter : counters) total += counter;
+    printf("Threads,%u,Words,%u,%s,Mwords/s,%g\n", numthreads, numwords,
+           testname.c_str(), total * 1E3 / elapsed);
+}
+
 // All our containers, templated by allocator type
 template <class Key, class Value, class Allocator>
 using BoostFlatMapType =
@@ -61,6 +93,10 @@ template <typename ValueType>
 using hugepage = retail_allocator<ValueType, hugepage_allocator>;
 template <typename ValueType>
 using boostpmr = BoostAllocator<ValueType>;
+template <typename ValueType>
+using threaded = threaded_retail_allocator<ValueType, standard_allocator>;
+template <typename ValueType>
+using threadhuge = threaded_retail_allocator<ValueType, transparent_allocator>;
 
 int main() {
     // Read the text and make all uppercase
@@ -185,4 +221,21 @@ int main() {
     }
 
     summary(snap.getEvents(), "WordMap");
+
+    // Scaling across threads, only with the allocators that are thread safe
+    uint32_t maxthreads = std::max(1U, std::thread::hardware_concurrency());
+    for (uint32_t numthreads = 1; numthreads <= maxthreads; numthreads *= 2) {
+        testmt<StdMapType, stdalloc>("std::map<stdalloc>", allwords, allwords.size(),
+                                     numthreads, runsecs);
+        testmt<StdMapType, threaded>("std::map<threaded>", allwords, allwords.size(),
+                                     numthreads, runsecs);
+        testmt<StdMapType, threadhuge>("std::map<threadhuge>", allwords,
+                                       allwords.size(), numthreads, runsecs);
+        testmt<StdHashMapType, stdalloc>("std::unordered_map<stdalloc>", allwords,
+                                         allwords.size(), numthreads, runsecs);
+        testmt<StdHashMapType, threaded>("std::unordered_map<threaded>", allwords,
+                                         allwords.size(), numthreads, runsecs);
+        testmt<StdHashMapType, threadhuge>("std::unordered_map<threadhuge>", allwords,
+                                           allwords.size(), numthreads, runsecs);
+    }
 }
@@ -1,6 +1,8 @@
 
+#include "ConcurrentMicroStats.h"
 #include "CpuUtils.h"
 #include "MicroStats.h"
+#include "PerfGroup.h"
 #include "StringUtils.h"
 #include "TimingUtils.h"
 #include <cstdint>
@@ -24,6 +26,8 @@ struct Stats {
     Histogram hist;          // MicroStats histogram
     uint64_t pause;          // 99.9 percentile pauses
     uint64_t events;         // number of anomalies
+    int64_t switches;        // context switches on the core, any task (-1: n/a)
+    ConcurrentMicroStats<8> *all;  // Pauses of all cores together
 };
 
 double calcFrequencyGHz(uint64_t ticks) {
@@ -60,19 +64,31 @@ uint64_t quantum = calcQuantum(ROUGHLY_ONE_SECOND_IN_TICKS);
 double freqGHz = calcFrequencyGHz(ROUGHLY_ONE_SECOND_IN_TICKS);
 
 void collectJitterSamples(Stats &opt) {
+    // Counts everything that runs on the core, not only this thread, so
+    // other tasks and kernel work preempting us show up as context switches
+    PerfGroup others;
+    PerfGroup::Options options;
+    options.cpus = {opt.core};
+    options.kernel = true;
+    bool counting = others.init({"context-switches"}, options) && others.start();
+
     uint64_t threshold = 10 * quantum;
     uint64_t last = tic();
     busyWait(opt.wait_ticks, [&last, &opt, threshold](uint64_t now) {
         uint64_t diff = forward_difference(now, last);
-        if (diff > threshold) opt.hist.add(diff);
+        if (diff > threshold) {
+            opt.hist.add(diff);
+            opt.all->add(diff);
+        }
         last = now;
     });
+    opt.switches = (counting && others.stop()) ? int64_t(others[size_t(0)]) : -1;
     if (opt.print) {
         unsigned cpu = sched_getcpu();
         printf(
-            "Testing core %-2ld cpu:%-2d Isol:%-2s Events:%-6ld "
+            "Testing core %-2ld cpu:%-2d Isol:%-2s Events:%-6ld CtxSw:%-6ld "
             "Pct1/50/99: %-7ld %-7ld %-7ld\n",
-            opt.core, cpu, yn(isIsolated(opt.core)), opt.hist.count(),
+            opt.core, cpu, yn(isIsolated(opt.core)), opt.hist.count(), opt.switches,
             long(opt.hist.percentile(1)), long(opt.hist.percentile(50)),
             long(opt.hist.percentile(99.9)));
     }
@@ -134,9 +150,11 @@ void runAllTests(bool async) {
     auto wait_ticks = (async ? 10 : 1) * ROUGHLY_ONE_SECOND_IN_TICKS;
 
     std::vector<Stats> stats(numcores);
+    ConcurrentMicroStats<8> all(numcores);
     for (int core = 0; core < numcores; ++core) {
         Stats &opt(stats[core]);
         opt.core = core;
+        opt.all = &all;
         opt.wait_ticks = wait_ticks;
         opt.policy = SCHED_FIFO;
         opt.prio = sched_get_priority_max(SCHED_FIFO);
@@ -167,7 +185,11 @@ void runAllTests(bool async) {
         std::sort(isol_pause.begin(), isol_pause.end());
         min_pause = isol_pause[num_isol / 2];
     }
-    printf("\n>>> MinEvents:%ld MinPause:%ld ticks \n\n", min_events, min_pause);
+    printf("\n>>> MinEvents:%ld MinPause:%ld ticks \n", min_events, min_pause);
+    MicroStats<8> machine = all.snapshot();
+    printf(">>> All cores Events:%ld Pct1/50/99.9: %ld %ld %ld\n\n", machine.count(),
+           long(machine.percentile(1)), long(machine.percentile(50)),
+           long(machine.percentile(99.9)));
 
     int min_sd_prio = sched_get_priority_min(SCHED_OTHER);
     for (int core = 0; core < numcores; ++core) {
@@ -0,0 +1,110 @@
+/**
+ * Publishes a histogram and a set of values through TelemetryWriter and
+ * reads them back with TelemetryReader from a forked process, as a
+ * monitoring tool would. Also checks that the reader turns down a segment
+ * written with another layout version.
+ */
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "MMapFile.h"
+#include "MicroStats.h"
+#include "Telemetry.h"
+
+static const std::string SEGMENT = "/tinyperf_testtelemetry";
+
+// Latency-like histogram, spread over many bins
+static void fill(MicroStats<4>& hist) {
+    std::mt19937_64 generator(42);
+    std::lognormal_distribution<double> latency(7.0, 1.0);
+    for (uint32_t j = 0; j < 100000; ++j) hist.add(::llrint(latency(generator)));
+}
+
+// Runs fn in a child process and returns its result
+template <typename Fn>
+static bool forked(Fn&& fn) {
+    std::cout.flush();
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        bool ok = fn();
+        std::cout.flush();
+        ::_exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+static bool check(const char* what, bool ok) {
+    std::cout << "  " << what << ": " << (ok ? "ok" : "FAILED") << '\n';
+    return ok;
+}
+
+int main() {
+    const double values[3] = {1.5, -2.25, 1e300};
+    MicroStats<4> expected;
+    fill(expected);
+
+    TelemetryWriter writer;
+    if (!writer.init(SEGMENT, 16, 4096)) return 1;
+    int hslot = writer.slot("latency");
+    int vslot = writer.slot("counters.cycles");
+    bool ok = writer.publish(hslot, expected) && writer.publish(vslot, values, 3);
+    ok = check("writer publishes a histogram and values", ok);
+
+    std::cout << "Reader process:\n";
+    ok &= forked([&] {
+        TelemetryReader reader;
+        if (!check("opens the segment", reader.open(SEGMENT))) return false;
+        bool good = check("size() counts the slots", reader.size() == 2);
+        int h = reader.find("latency");
+        int v = reader.find("counters.cycles");
+        good &= check("find() returns the slots", (h == hslot) && (v == vslot));
+        good &= check("find() returns -1 for unknown names", reader.find("nope") == -1);
+        good &= check("kind() tells histograms and values apart",
+                      (reader.kind(h) == telemetry::Histogram) &&
+                          (reader.kind(v) == telemetry::Values));
+
+        MicroStats<4> hist;
+        bool read = reader.read(h, hist);
+        bool same = read && (hist.count() == expected.count());
+        for (uint32_t j = 0; same && (j < MicroStats<4>::NUMBINS); ++j) {
+            same = (hist.bincount(j) == expected.bincount(j)) &&
+                   (hist.binaverage(j) == expected.binaverage(j));
+        }
+        good &= check("histogram slot has the same bins", same);
+        MicroStats<2> other;
+        good &= check("histogram slot refuses another NDB", !reader.read(h, other));
+
+        std::vector<double> got;
+        good &= check("values slot has the same values",
+                      reader.read(v, got) && (got.size() == 3) && (got[0] == values[0]) &&
+                          (got[1] == values[1]) && (got[2] == values[2]));
+        good &= check("values slot is not a histogram", !reader.read(v, hist));
+        return good;
+    });
+
+    // Pretend the segment was written with another layout
+    MMapFile raw;
+    if (raw.open(SEGMENT, false)) {
+        telemetry::Header* header = static_cast<telemetry::Header*>(raw.data());
+        header->version = telemetry::VERSION + 1;
+    }
+    std::cout << "Reader process, other version:\n";
+    ok &= forked([] {
+        TelemetryReader reader;
+        return check("refuses to open the segment", !reader.open(SEGMENT)) &&
+               check("has no slots", reader.size() == 0);
+    });
+
+    MMapFile::unlink(SEGMENT);
+    std::cout << (ok ? "All telemetry checks passed" : "Some telemetry checks FAILED")
+              << '\n';
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+#include "Histogram.h"
+#include "MicroStats.h"
+#include "TimingUtils.h"
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Per-add cost of the histograms used by timeit(), fed with values shaped
+// like the cycle counts of a timed loop
+template <typename Fn>
+double costPerAdd(const std::vector<std::uint64_t>& values, Fn&& add) {
+    std::uint64_t t0 = tic();
+    for (std::uint32_t loop = 0; loop < 10; ++loop) {
+        for (std::uint64_t value : values) add(value);
+    }
+    std::uint64_t t1 = tic();
+    return double(t1 - t0) / (10 * values.size());
+}
+
+// Checks that addTicks() puts every integer in the bin add() picks, around
+// each bin edge and at random over the range
+template <std::uint32_t NUMBINS>
+bool ticksMatch(double min, double max) {
+    std::vector<std::uint64_t> values;
+    for (std::uint32_t k = 0; k <= NUMBINS; ++k) {
+        double edge = min + k * (max - min) / NUMBINS;
+        for (int delta = -2; delta <= 2; ++delta) {
+            if (edge + delta >= 0) values.push_back(std::uint64_t(edge + delta));
+        }
+    }
+    std::mt19937_64 generator;
+    std::uniform_int_distribution<std::uint64_t> anywhere(0,
+                                                          std::uint64_t(max * 1.1) + 2);
+    for (std::uint32_t j = 0; j < 100000; ++j) values.push_back(anywhere(generator));
+
+    FastHistogram<NUMBINS> byvalue(min, max);
+    FastHistogram<NUMBINS> byticks(min, max);
+    for (std::uint64_t value : values) {
+        byvalue.add(double(value));
+        byticks.addTicks(value);
+    }
+    bool same = true;
+    for (std::uint32_t j = 0; j < NUMBINS; ++j) {
+        same = same && (byvalue.bincount(j) == byticks.bincount(j));
+    }
+    std::cout << "  FastHistogram<" << NUMBINS << ">(" << min << ", " << max << ") "
+              << (same ? "same bins" : "DIFFERENT BINS") << '\n';
+    return same;
+}
+
+int main() {
+    std::mt19937_64 generator;
+    std::lognormal_distribution<double> timings(5.5, 0.4);
+    std::vector<std::uint64_t> values(1000000);
+    for (std::uint64_t& value : values) value = ::llrint(timings(generator));
+
+    static Histogram<100> slow(0, 1000);
+    static FastHistogram<100> fast(0, 1000);
+    static FastHistogram<100> ticks(0, 1000);
+    static FastHistogram<100, true> deferred(0, 1000);
+    static MicroStats<2> micro;
+
+    std::cout << "Cost per add (ticks):\n";
+    std::cout << "  Histogram<100>            "
+              << costPerAdd(values, [](std::uint64_t v) { slow.add(double(v)); }) << '\n';
+    std::cout << "  FastHistogram<100>        "
+              << costPerAdd(values, [](std::uint64_t v) { fast.add(double(v)); }) << '\n';
+    std::cout << "  FastHistogram<100> ticks  "
+              << costPerAdd(values, [](std::uint64_t v) { ticks.addTicks(v); }) << '\n';
+    std::cout << "  FastHistogram<100,true>   "
+              << costPerAdd(values, [](std::uint64_t v) { deferred.add(double(v)); })
+              << '\n';
+    std::cout << "  MicroStats<2>             "
+              << costPerAdd(values, [](std::uint64_t v) { micro.add(v); }) << '\n';
+
+    std::cout << "Percentiles:\n";
+    std::cout << "  Histogram<100>            " << slow << '\n';
+    std::cout << "  FastHistogram<100>        " << fast << '\n';
+    std::cout << "  FastHistogram<100> ticks  " << ticks << '\n';
+    std::cout << "  FastHistogram<100,true>   " << deferred << '\n';
+    std::cout << "  MicroStats<2>             " << micro << '\n';
+
+    std::cout << "add() vs addTicks():\n";
+    bool ok = ticksMatch<10>(0.5, 10.5) & ticksMatch<100>(0, 1000) &
+              ticksMatch<100>(0, 10) & ticksMatch<64>(3.3, 70000.7) &
+              ticksMatch<1000>(250.25, 1000000.75) & ticksMatch<7>(0, 1e12);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+#include "KahanSum.h"
+#include "TimingUtils.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Values over twelve orders of magnitude where every large value is later
+// cancelled by its negative, so the total is tiny next to the terms
+static std::vector<double> cancelling(std::size_t n, std::mt19937_64& generator) {
+    std::uniform_real_distribution<double> mantissa(-1, 1);
+    std::uniform_int_distribution<int> exponent(0, 12);
+    std::vector<double> values;
+    while (values.size() + 2 <= n) {
+        double value = mantissa(generator) * std::pow(10.0, exponent(generator));
+        values.push_back(value);
+        values.push_back(-value);
+        // Small leftovers survive the cancellation
+        values.back() += mantissa(generator) * 1E-3;
+    }
+    if (values.size() < n) values.push_back(mantissa(generator));
+    std::shuffle(values.begin(), values.end(), generator);
+    return values;
+}
+
+// Neumaier summation in long double, the reference for the kernels
+static long double reference(const std::vector<double>& values) {
+    long double sum = 0;
+    long double compensation = 0;
+    for (double value : values) {
+        long double t = sum + value;
+        if (std::fabs(sum) >= std::fabs(value)) {
+            compensation += (sum - t) + value;
+        } else {
+            compensation += (value - t) + sum;
+        }
+        sum = t;
+    }
+    return sum + compensation;
+}
+
+// Checks that a kernel is within bound of the reference
+static bool check(const char* kernel, std::size_t n, double value, long double exact,
+                  double bound) {
+    double error = std::fabs(double(value - exact));
+    bool ok = error <= bound;
+    if (!ok) {
+        std::cout << "  " << kernel << " n=" << n << ": error " << error << " exceeds "
+                  << bound << '\n';
+    }
+    return ok;
+}
+
+template <typename Fn>
+static double ticksPerValue(const std::vector<double>& values, Fn&& sum) {
+    volatile double sink = 0;
+    std::uint64_t t0 = tic();
+    for (std::uint32_t loop = 0; loop < 20; ++loop) sink = sink + sum(values);
+    std::uint64_t t1 = tic();
+    return double(t1 - t0) / (20 * values.size());
+}
+
+int main() {
+    std::mt19937_64 generator;
+    bool ok = true;
+    std::cout << "Accuracy against a long double reference:\n";
+    // Short inputs and tails that do not fill a vector of lanes
+    for (std::size_t n :
+         {0, 1, 2, 3, 5, 7, 8, 9, 13, 15, 16, 17, 100, 257, 1001, 65541}) {
+        std::vector<double> values = cancelling(n, generator);
+        long double exact = reference(values);
+        double sumabs = 0;
+        for (double value : values) sumabs += std::fabs(value);
+        // Neumaier is off by an ulp of the result plus a second order term,
+        // pairwise by the depth of its tree times the size of the terms
+        double neumaier = 2 * DBL_EPSILON * std::fabs(double(exact)) +
+                          n * DBL_EPSILON * DBL_EPSILON * sumabs;
+        double pairwise = (std::log2(n + 1.0) + 40) * DBL_EPSILON * sumabs;
+
+        ok &= check("scalar", n, kahan::neumaier_sum_scalar(values.data(), n)(), exact,
+                    neumaier);
+#ifdef KAHAN_X86_DISPATCH
+        if (kahan::has_avx2()) {
+            ok &= check("AVX2", n, kahan::neumaier_sum_avx2(values.data(), n)(), exact,
+                        neumaier);
+        }
+#endif
+        ok &= check("pairwise", n, kahan::pairwise_sum(values.data(), n), exact,
+                    pairwise);
+        KahanSum<double> batch;
+        batch.add(values.data(), n);
+        ok &= check("KahanSum::add(array)", n, batch(), exact, neumaier);
+    }
+    std::cout << (ok ? "  all kernels within bounds" : "  SOME KERNELS OUT OF BOUNDS")
+              << '\n';
+
+    std::vector<double> values = cancelling(1 << 22, generator);
+    long double exact = reference(values);
+    auto error = [exact](double value) { return std::fabs(double(value - exact)); };
+    double naive = 0;
+    for (double value : values) naive += value;
+    KahanSum<double> serial;
+    for (double value : values) serial.add(value);
+    std::cout << "Absolute error on " << values.size() << " values (sum " << double(exact)
+              << "):\n";
+    std::cout << "  naive loop            " << error(naive) << '\n';
+    std::cout << "  serial KahanSum::add  " << error(serial()) << '\n';
+    std::cout << "  neumaier_sum          "
+              << error(kahan::neumaier_sum(values.data(), values.size())()) << '\n';
+    std::cout << "  pairwise_sum          "
+              << error(kahan::pairwise_sum(values.data(), values.size())) << '\n';
+
+    using Values = std::vector<double>;
+    auto naiveloop = [](const Values& v) {
+        double sum = 0;
+        for (double value : v) sum += value;
+        return sum;
+    };
+    auto serialloop = [](const Values& v) {
+        KahanSum<double> sum;
+        for (double value : v) sum.add(value);
+        return sum();
+    };
+    auto batchadd = [](const Values& v) {
+        KahanSum<double> sum;
+        sum.add(v.data(), v.size());
+        return sum();
+    };
+    auto scalar = [](const Values& v) {
+        return kahan::neumaier_sum_scalar(v.data(), v.size())();
+    };
+    auto pairwise = [](const Values& v) {
+        return kahan::pairwise_sum(v.data(), v.size());
+    };
+    std::cout << "Cost per value (ticks):\n";
+    std::cout << "  naive loop            " << ticksPerValue(values, naiveloop) << '\n';
+    std::cout << "  serial KahanSum::add  " << ticksPerValue(values, serialloop) << '\n';
+    std::cout << "  KahanSum::add(array)  " << ticksPerValue(values, batchadd) << '\n';
+    std::cout << "  neumaier_sum_scalar   " << ticksPerValue(values, scalar) << '\n';
+#ifdef KAHAN_X86_DISPATCH
+    if (kahan::has_avx2()) {
+        auto avx2 = [](const Values& v) {
+            return kahan::neumaier_sum_avx2(v.data(), v.size())();
+        };
+        std::cout << "  neumaier_sum_avx2     " << ticksPerValue(values, avx2) << '\n';
+    }
+#endif
+    std::cout << "  pairwise_sum          " << ticksPerValue(values, pairwise) << '\n';
+    return ok ? 0 : 1;
+}
@@ -1,19 +1,38 @@
 #include "MicroStats.h"
+#include "CompactMicroStats.h"
+#include "TimingUtils.h"
+#include <cmath>
 #include <iostream>
 #include <random>
+#include <vector>
 
-#if defined(__GNUC__) && defined(__x86_64__)
-#include <x86intrin.h>
-uint64_t nowts() {
-    return __rdtsc();
-}
-#else
-#include <chrono>
-uint64_t nowts() {
-    using std::chrono;
-    return duration_cast<nanoseconds>(system_clock::nowts().time_since_epoch()).count();
+//! Checks that the batch add() of every SIMD kernel bins like the scalar add()
+template <uint32_t NDB>
+bool checkBatch(const std::vector<uint64_t>& values) {
+    const char* names[] = {"scalar", "AVX2", "AVX-512"};
+    static MicroStats<NDB> scalar, batch;
+    scalar.clear();
+    for (uint64_t value : values) scalar.add(value);
+    bool ok = true;
+    for (auto level : {microstats::SimdLevel::Scalar, microstats::SimdLevel::AVX2,
+                       microstats::SimdLevel::AVX512}) {
+        if (level > microstats::detect()) break;
+        batch.clear();
+        batch.add(values.data(), values.size(), level);
+        bool same = batch.count() == scalar.count();
+        for (uint32_t j = 0; j < MicroStats<NDB>::NUMBINS; ++j) {
+            same = same && (batch.bincount(j) == scalar.bincount(j)) &&
+                   (batch.binaverage(j) == scalar.binaverage(j));
+        }
+        // The batch total is summed in four partial chains, so it may round differently
+        double error = std::fabs(batch.average() - scalar.average()) / scalar.average();
+        same = same && (error < 1E-12);
+        std::cout << "Batch add() with " << names[int(level)] << " bins, NDB=" << NDB
+                  << ": " << (same ? "matches" : "DIFFERS FROM") << " scalar add()\n";
+        ok = ok && same;
+    }
+    return ok;
 }
-#endif
 
 template <uint32_t N>
 void summary(const std::string& title, const MicroStats<N>& ms) {
@@ -75,10 +94,10 @@ int main(int argc, char* argv[]) {
         double number = distribution(generator);
         if (number < 0) number = 0;
         uint64_t unumber = ::llrint(number);
-        uint64_t t0 = nowts();
+        uint64_t t0 = tic();
         if (t0 > 0) {
             ms.add(unumber);
-            uint64_t t1 = nowts();
+            uint64_t t1 = tic();
             if (t1 > t0) tms.add(t1 - t0);
         }
     }
@@ -90,13 +109,63 @@ int main(int argc, char* argv[]) {
     tms.clear();
 
     for (uint32_t j = 0; j < 10000000; ++j) {
-        uint64_t t0 = nowts();
+        uint64_t t0 = tic();
         if (t0 > 0) {
             // asm __volatile__( "nop" );
-            uint64_t t1 = nowts();
+            uint64_t t1 = tic();
             if (t1 > t0) tms.add(t1 - t0);
         }
     }
     std::cout << "Cost of measuring only" << '\n';
     summary("Measuring Cost Only", tms);
+
+    // Wide spread of values so add() touches bins all over the histogram
+    std::lognormal_distribution<double> spread(10.0, 3.0);
+    std::vector<uint64_t> values(1000000);
+    for (uint64_t& value : values) value = ::llrint(spread(generator));
+    auto costOfAdd = [&values](auto& hist) {
+        uint64_t t0 = tic();
+        for (uint32_t loop = 0; loop < 10; ++loop) {
+            for (uint64_t value : values) hist.add(value);
+        }
+        uint64_t t1 = tic();
+        return double(t1 - t0) / (10 * values.size());
+    };
+    static MicroStats<8> wide;
+    static CompactMicroStats<8> compact;
+    std::cout << "Cost of add() with MicroStats<8> (" << sizeof(wide)
+              << " bytes): " << costOfAdd(wide) << " ticks\n";
+    std::cout << "Cost of add() with CompactMicroStats<8> (" << sizeof(compact)
+              << " bytes): " << costOfAdd(compact) << " ticks\n";
+    std::cout << "p50/p99: " << wide.percentile(50) << "/" << wide.percentile(99)
+              << " vs " << compact.percentile(50) << "/" << compact.percentile(99)
+              << '\n';
+
+    // Values of every bit length, including above 32 bits where the SIMD
+    // kernels split the value in halves, plus the edges of each power of two
+    std::vector<uint64_t> mixed;
+    std::mt19937_64 bits;
+    for (uint32_t nb = 0; nb < 63; ++nb) {
+        uint64_t base = 1ULL << nb;
+        for (uint64_t value : {base - 1, base, base + 1, 2 * base - 1}) mixed.push_back(value);
+    }
+    while (mixed.size() < 100003) mixed.push_back(bits() >> (1 + bits() % 63));
+    bool ok = checkBatch<0>(mixed) & checkBatch<2>(mixed) & checkBatch<4>(mixed) &
+              checkBatch<8>(mixed);
+
+    // Same values through the batch add(), per SIMD kernel
+    const char* names[] = {"scalar", "AVX2", "AVX-512"};
+    for (auto level : {microstats::SimdLevel::Scalar, microstats::SimdLevel::AVX2,
+                       microstats::SimdLevel::AVX512}) {
+        if (level > microstats::detect()) break;
+        wide.clear();
+        uint64_t t0 = tic();
+        for (uint32_t loop = 0; loop < 10; ++loop) {
+            wide.add(values.data(), values.size(), level);
+        }
+        uint64_t t1 = tic();
+        std::cout << "Cost of batch add() with " << names[int(level)] << " bins: "
+                  << double(t1 - t0) / (10 * values.size()) << " ticks\n";
+    }
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,99 @@
+/**
+ * Checks that ProbeRegistry::publish() collects every record exactly once
+ * while threads keep recording, from idle threads and from threads that
+ * exit. Run with --fence to use the fence fallback instead of membarrier,
+ * which ThreadSanitizer can follow.
+ */
+#include "ProbeRegistry.h"
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Publishes once and returns what was collected for the probe
+static uint64_t collect(const char* name) {
+    ProbeRegistry& registry(ProbeRegistry::instance());
+    registry.publish();
+    for (const ProbeRegistry::Stats& stats : registry.latest()) {
+        if (stats.name == name) return stats.count;
+    }
+    return 0;
+}
+
+static bool check(const char* what, uint64_t count, uint64_t expected) {
+    bool ok = count == expected;
+    std::cout << "  " << what << ": " << count << " of " << expected
+              << (ok ? " ok" : " FAILED") << '\n';
+    return ok;
+}
+
+// Records from its destructor, which runs after the registry's own
+// thread_local owner when constructed before the first record
+struct LateRecorder {
+    uint32_t probe;
+    ~LateRecorder() {
+        for (uint32_t j = 0; j < 10; ++j) ProbeRegistry::record(probe, j);
+    }
+};
+
+int main(int argc, char* argv[]) {
+    // The registry sets up membarrier, before any thread records
+    ProbeRegistry::instance();
+    if ((argc > 1) && (std::string(argv[1]) == "--fence")) probe_membarrier = false;
+    std::cout << "Barrier: " << (probe_membarrier ? "membarrier" : "fence") << '\n';
+    bool ok = true;
+
+    // Busy threads, published as fast as possible while they record
+    constexpr uint32_t NUMTHREADS = 4;
+    constexpr uint64_t NUMRECORDS = 1000000;
+    const uint32_t busy = probe_id("test.busy");
+    std::atomic<uint32_t> running{NUMTHREADS};
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < NUMTHREADS; ++t) {
+        threads.emplace_back([&, t]() {
+            for (uint64_t j = 0; j < NUMRECORDS; ++j) {
+                ProbeRegistry::record(busy, (j + t) % 1000);
+            }
+            running--;
+        });
+    }
+    uint64_t total = 0;
+    uint32_t rounds = 0;
+    while (running.load() > 0) {
+        total += collect("test.busy");
+        ++rounds;
+    }
+    for (std::thread& thread : threads) thread.join();
+    total += collect("test.busy");
+    std::cout << "Busy threads, " << rounds << " publishes while recording\n";
+    ok &= check("records collected", total, NUMTHREADS * NUMRECORDS);
+
+    // A thread that stays alive but stops recording
+    const uint32_t idle = probe_id("test.idle");
+    std::atomic<int> stage{0};
+    std::thread sleeper([&]() {
+        for (uint64_t j = 0; j < 1000; ++j) ProbeRegistry::record(idle, j);
+        stage = 1;
+        while (stage.load() != 2) std::this_thread::yield();
+    });
+    while (stage.load() != 1) std::this_thread::yield();
+    std::cout << "Idle thread\n";
+    ok &= check("records collected while it idles", collect("test.idle"), 1000);
+    stage = 2;
+    sleeper.join();
+    ok &= check("nothing left after it exits", collect("test.idle"), 0);
+
+    // Records made after the thread handed its probes over are dropped
+    const uint32_t late = probe_id("test.late");
+    std::thread exiting([&]() {
+        thread_local LateRecorder recorder{late};
+        for (uint64_t j = 0; j < 10; ++j) ProbeRegistry::record(late, j);
+    });
+    exiting.join();
+    std::cout << "Records from thread_local destructors\n";
+    ok &= check("records before the owner exits", collect("test.late"), 10);
+
+    std::cout << (ok ? "All probe registry checks passed" : "Some checks FAILED") << '\n';
+    return ok ? 0 : 1;
+}
@@ -3,10 +3,13 @@
 #include <iostream>
 #include <random>
 #include <sstream>
+#include <cstring>
 #include "SchedulerPriorityQueue.h"
 #include "SchedulerMultimap.h"
 #include "Snapshot.h"
 #include "Regression.h"
+#include "PerfSampler.h"
+#include "BranchProfile.h"
 
 template <class Scheduler>
 void test(Snapshot& snap, uint64_t numitems, uint64_t numclasses, uint64_t numloops) {
@@ -66,8 +69,17 @@ void test(Snapshot& snap, uint64_t numitems, uint64_t numclasses, uint64_t numlo
 
 int main(int argc, char* argv[]) {
     uint32_t numclasses = argc > 1 ? atoi(argv[1]) : 1;
+    // Pass "lbr" as second argument to capture the branch stacks on mispredictions
+    bool lbr = (argc > 2) && (::strcmp(argv[2], "lbr") == 0);
     for (std::string ctype : {"PriorityQueue", "MultiMap"}) {
         Snapshot snap({"cycles"});
+        PerfSampler sampler;
+        if (lbr) {
+            PerfSampler::Options options;
+            options.branches = true;
+            options.period = 10007;
+            if (sampler.init("branch-misses", options)) snap.setSampler(&sampler);
+        }
         for (uint64_t numitems : {50000, 100000, 250000, 1000000, 2500000, 10000000}) {
             // This is to maintain the time for each run approx constant
             uint64_t numloops = 10000000. / uint64_t(numitems);
@@ -79,6 +91,15 @@ int main(int argc, char* argv[]) {
         }
 
         summary(snap.getEvents(), ctype, "cycles");
+
+        for (const char* name : {"Check", "ReCheck"}) {
+            auto it = sampler.getSamples().find(name);
+            if (it == sampler.getSamples().end()) continue;
+            BranchProfile profile;
+            profile.add(it->second);
+            std::cout << ctype << ", Event:" << name << "\n";
+            profile.print(std::cout);
+        }
     };
 
     return 0;